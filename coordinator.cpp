@@ -0,0 +1,785 @@
+// Distributes flagging jobs across hosts.
+// A coordinator queues jobs submitted by clients and hands them to workers, preferring
+// workers on the host that owns the recording and those that are least loaded.
+// Workers run jobs with a pool of threads and return their reports via the coordinator.
+// Public domain.
+//
+// Protocol: lines of <type>@<args>. A data@ line is followed by <bytes> of AU audio.
+//   client -> coordinator : job@<owner host> <threshold> <minquiet> <mindetect> <minlength> <maxsep> <pad> <file>
+//                           data@<job> <bytes>, end@<job>     audio for a job whose file is "-"
+//   coordinator -> client : queued@<job>, started@<job> <host>, <level>@<job> <report>, done@<job> <frames|failed>
+//   worker -> coordinator : worker@<host> <slots>, load@<load average> <cpus>,
+//                           <level>@<job> <report>, done@<job> <frames|failed>
+//   coordinator -> worker : job@<job> <presets> <file>, data@<job> <bytes>, end@<job>, cancel@<job>
+//
+// There is no authentication: anyone who can connect can have workers read any file they can, and run
+// the decoder on it. So the coordinator listens on loopback unless given the address of a trusted network.
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cstdarg>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "silence.h"
+
+std::string format(const char* fmt, ...)
+// printf to a string
+{
+    char text[1000];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(text, sizeof text, fmt, args);
+    va_end(args);
+    return text;
+}
+
+class Connection
+// A TCP connection carrying lines, some of which are followed by a block of data
+{
+public:
+    const int fd;
+    std::string host;     // peer host name, once known
+
+    Connection(int _fd) : fd(_fd)
+    {
+        // reports are small & should be delivered promptly
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on);
+    }
+
+    ~Connection()
+    {
+        close(fd);
+    }
+
+    bool receive()
+    // Read whatever has arrived. Returns false when the connection has closed
+    {
+        char block[1 << 16];
+        ssize_t got;
+        while ((got = recv(fd, block, sizeof block, 0)) < 0 && EINTR == errno)
+            ;
+        if (got <= 0)
+            return false;
+        received.append(block, got);
+        return true;
+    }
+
+    bool next(std::string& line, std::string& data)
+    // Extract the next complete line and any data following it. Returns false if there isn't one
+    {
+        size_t end = received.find('\n');
+        if (std::string::npos == end)
+            return false;
+        unsigned long length = 0;
+        if (0 == received.compare(0, 5, "data@"))
+            sscanf(received.c_str() + 5, "%*u %lu", &length);
+        if (received.size() < end + 1 + length)
+            return false;
+        line.assign(received, 0, end);
+        data.assign(received, end + 1, length);
+        received.erase(0, end + 1 + length);
+        return true;
+    }
+
+    bool send(const std::string& line, const std::string& data = std::string())
+    // Send a line and any data following it. May be called from any thread
+    {
+        std::lock_guard<std::mutex> lock(sending);
+        std::string message = line + '\n' + data;
+        for (size_t sent = 0; sent < message.size();)
+        {
+            ssize_t n = ::send(fd, message.data() + sent, message.size() - sent, MSG_NOSIGNAL);
+            if (n < 0 && EINTR != errno)
+                return false;
+            if (n > 0)
+                sent += n;
+        }
+        return true;
+    }
+
+    void queue(const std::string& line, const std::string& data = std::string())
+    // Queue a line and any data following it, to be sent by flush()
+    {
+        pending += line;
+        pending += '\n';
+        pending += data;
+    }
+
+    bool flush()
+    // Send as much queued output as the connection will take without blocking
+    {
+        while (!pending.empty())
+        {
+            ssize_t n = ::send(fd, pending.data(), pending.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n < 0)
+                return (EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno);
+            pending.erase(0, n);
+        }
+        return true;
+    }
+
+    size_t backlog() const
+    {
+        return pending.size();
+    }
+
+private:
+    std::string received; // data not yet processed
+    std::string pending;  // queued output
+    std::mutex sending;
+};
+
+int connectTo(const char* address)
+// Connect to host:port
+{
+    std::string host(address);
+    size_t colon = host.rfind(':');
+    if (std::string::npos == colon)
+        error("Address must be <host>:<port>");
+    const std::string port = host.substr(colon + 1);
+    host.erase(colon);
+
+    addrinfo hints, *found;
+    memset(&hints, 0, sizeof hints);
+    hints.ai_socktype = SOCK_STREAM;
+    if (0 != getaddrinfo(host.c_str(), port.c_str(), &hints, &found))
+        error("Could not find coordinator");
+    int fd = -1;
+    for (addrinfo* a = found; a && fd < 0; a = a->ai_next)
+    {
+        fd = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+        if (fd >= 0 && 0 != connect(fd, a->ai_addr, a->ai_addrlen))
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(found);
+    if (fd < 0)
+        error("Could not connect to coordinator");
+    return fd;
+}
+
+std::string hostName()
+{
+    char name[256] = "";
+    gethostname(name, sizeof name - 1);
+    return name;
+}
+
+class Coordinator
+// Queues jobs & hands them to the workers best placed to run them
+{
+private:
+    static const float kremote; // cost of reading a recording from another host, in load per CPU
+    static const size_t kbacklog = 1 << 20; // bytes of output queued for a worker before its client is throttled
+
+    struct Node
+    // A worker
+    {
+        Connection* conn;
+        unsigned slots;   // jobs it will run at once
+        unsigned busy;    // jobs it is running
+        float load;       // load average per CPU
+    };
+
+    struct Job
+    {
+        unsigned id;
+        std::string owner; // host that owns the recording
+        std::string spec;  // presets & file
+        Connection* client;
+        Node* node;        // worker running it
+        std::deque<std::pair<std::string, std::string> > pending; // audio sent before it started
+    };
+
+    std::map<int, Connection*> unknown; // connections yet to identify themselves
+    std::map<int, Connection*> clients;
+    std::map<int, Node*> nodes;
+    std::map<unsigned, Job*> jobs;
+    std::deque<Job*> queue;
+    unsigned lastId;
+
+    float cost(const Node* node, const Job* job) const
+    // Cost of running a job on a node: its load, plus a penalty for remote recordings
+    {
+        return node->load + (node->conn->host == job->owner ? 0 : kremote);
+    }
+
+    void dispatch()
+    // Hand queued jobs to the cheapest workers with free slots
+    {
+        while (!queue.empty())
+        {
+            Job* job = queue.front();
+            Node* best = NULL;
+            for (std::map<int, Node*>::iterator n = nodes.begin(); n != nodes.end(); ++n)
+                if (n->second->busy < n->second->slots && (!best || cost(n->second, job) < cost(best, job)))
+                    best = n->second;
+            if (!best)
+                return; // all busy
+
+            queue.pop_front();
+            job->node = best;
+            best->busy++;
+            // count the job against the load until the worker next reports
+            best->load += 1.0 / best->slots;
+            best->conn->queue(format("job@%u %s", job->id, job->spec.c_str()));
+            for (; !job->pending.empty(); job->pending.pop_front())
+                best->conn->queue(job->pending.front().first, job->pending.front().second);
+            job->client->queue(format("started@%u %s", job->id, best->conn->host.c_str()));
+            printf("%sJob %u started on %s\n", prefixinfo, job->id, best->conn->host.c_str());
+        }
+    }
+
+    void finish(Job* job, const std::string& result)
+    // Remove a job that has finished or failed
+    {
+        if (job->node)
+            job->node->busy--;
+        else
+            queue.erase(std::find(queue.begin(), queue.end(), job));
+        printf("%sJob %u done: %s\n", prefixinfo, job->id, result.c_str());
+        jobs.erase(job->id);
+        delete job;
+    }
+
+    Job* find(const std::string& args)
+    // Find job from the id at the start of message args
+    {
+        std::map<unsigned, Job*>::iterator j = jobs.find(strtoul(args.c_str(), NULL, 10));
+        return (j == jobs.end() ? NULL : j->second);
+    }
+
+    void fromClient(Connection* conn, const std::string& type, const std::string& args,
+                    const std::string& line, const std::string& data)
+    {
+        if ("job" == type)
+        {
+            size_t space = args.find(' ');
+            if (std::string::npos == space)
+            {
+                conn->queue("err@Malformed job");
+                return;
+            }
+            Job* job = new Job;
+            job->id = ++lastId;
+            job->owner = args.substr(0, space);
+            job->spec = args.substr(space + 1);
+            job->client = conn;
+            job->node = NULL;
+            jobs[job->id] = job;
+            queue.push_back(job);
+            conn->queue(format("queued@%u", job->id));
+            printf("%sJob %u queued from %s: %s\n", prefixinfo, job->id, job->owner.c_str(), job->spec.c_str());
+            dispatch();
+        }
+        else if ("data" == type || "end" == type)
+        {
+            // relay audio to the worker running the job, or keep it until one does
+            Job* job = find(args);
+            if (!job || job->client != conn)
+                return;
+            if (job->node)
+                job->node->conn->queue(line, data);
+            else
+                job->pending.push_back(std::make_pair(line, data));
+        }
+    }
+
+    void fromWorker(Node* node, const std::string& type, const std::string& args, const std::string& line)
+    {
+        if ("load" == type)
+        {
+            sscanf(args.c_str(), "%f", &node->load);
+            dispatch();
+            return;
+        }
+        // everything else is a report for the client of a job
+        Job* job = find(args);
+        if (!job || job->node != node)
+            return;
+        job->client->queue(line);
+        if ("done" == type)
+        {
+            finish(job, args.substr(args.find(' ') + 1));
+            dispatch();
+        }
+    }
+
+    void closed(int fd)
+    // Clean up after a connection closes
+    {
+        std::map<int, Node*>::iterator n = nodes.find(fd);
+        for (std::map<unsigned, Job*>::iterator j = jobs.begin(); j != jobs.end();)
+        {
+            Job* job = (j++)->second;
+            if (n != nodes.end() && job->node == n->second)
+            {
+                // worker has gone
+                job->client->queue(format("done@%u failed", job->id));
+                finish(job, "failed, lost worker");
+            }
+            else if (clients.count(fd) && job->client == clients[fd])
+            {
+                // nobody wants the result
+                if (job->node)
+                    job->node->conn->queue(format("cancel@%u", job->id));
+                finish(job, "cancelled");
+            }
+        }
+        if (n != nodes.end())
+        {
+            printf("%sWorker %s left\n", prefixinfo, n->second->conn->host.c_str());
+            delete n->second->conn;
+            delete n->second;
+            nodes.erase(n);
+        }
+        else if (clients.count(fd))
+        {
+            delete clients[fd];
+            clients.erase(fd);
+        }
+        else
+        {
+            delete unknown[fd];
+            unknown.erase(fd);
+        }
+        dispatch();
+    }
+
+    void received(int fd)
+    // Process all complete messages from a connection
+    {
+        Connection* conn = (nodes.count(fd) ? nodes[fd]->conn : clients.count(fd) ? clients[fd] : unknown[fd]);
+        std::string line, data;
+        while (conn->next(line, data))
+        {
+            size_t at = line.find('@');
+            const std::string type = line.substr(0, at);
+            const std::string args = (std::string::npos == at ? "" : line.substr(at + 1));
+
+            if (unknown.count(fd))
+            {
+                // first message identifies the peer
+                unknown.erase(fd);
+                if ("worker" == type)
+                {
+                    Node* node = new Node;
+                    char host[256] = "";
+                    node->conn = conn;
+                    node->slots = 1;
+                    node->busy = 0;
+                    node->load = 0;
+                    sscanf(args.c_str(), "%255s %u", host, &node->slots);
+                    conn->host = host;
+                    nodes[fd] = node;
+                    printf("%sWorker %s joined with %u slots\n", prefixinfo, host, node->slots);
+                    dispatch();
+                    continue;
+                }
+                clients[fd] = conn;
+            }
+            if (nodes.count(fd))
+                fromWorker(nodes[fd], type, args, line);
+            else
+                fromClient(conn, type, args, line, data);
+        }
+    }
+
+    bool throttled(const Connection* client) const
+    // Whether a client is streaming to a worker with too much audio waiting to be sent
+    {
+        for (std::map<unsigned, Job*>::const_iterator j = jobs.begin(); j != jobs.end(); ++j)
+            if (j->second->client == client && j->second->node && j->second->node->conn->backlog() > kbacklog)
+                return true;
+        return false;
+    }
+
+public:
+    Coordinator() : lastId(0) {}
+
+    int run(const char* address)
+    // Serve clients & workers on [<address>:]<port>, loopback by default, until killed
+    {
+        std::string host(address), port(address);
+        const size_t colon = host.rfind(':');
+        if (std::string::npos == colon)
+            host = "127.0.0.1";
+        else
+        {
+            port.erase(0, colon + 1);
+            host.erase(colon);
+            // [<IPv6 address>]
+            if (host.size() > 1 && '[' == host[0] && ']' == host[host.size() - 1])
+                host = host.substr(1, host.size() - 2);
+        }
+
+        addrinfo hints, *found;
+        memset(&hints, 0, sizeof hints);
+        hints.ai_socktype = SOCK_STREAM;
+        if (0 != getaddrinfo(host.c_str(), port.c_str(), &hints, &found))
+            error("Invalid coordinator address");
+        int listener = -1;
+        for (addrinfo* a = found; a && listener < 0; a = a->ai_next)
+        {
+            listener = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+            int on = 1;
+            if (listener >= 0 && (0 != setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on)
+                                  || 0 != bind(listener, a->ai_addr, a->ai_addrlen) || 0 != listen(listener, 64)))
+            {
+                close(listener);
+                listener = -1;
+            }
+        }
+        freeaddrinfo(found);
+        if (listener < 0)
+            error("Could not listen on coordinator address");
+        printf("%sCoordinating on %s port %s\n", prefixinfo, host.c_str(), port.c_str());
+
+        std::vector<pollfd> waiting;
+        while (true)
+        {
+            waiting.clear();
+            pollfd listen = {listener, POLLIN, 0};
+            waiting.push_back(listen);
+            std::map<int, Connection*> all(unknown);
+            all.insert(clients.begin(), clients.end());
+            for (std::map<int, Node*>::iterator n = nodes.begin(); n != nodes.end(); ++n)
+                all[n->first] = n->second->conn;
+            for (std::map<int, Connection*>::iterator c = all.begin(); c != all.end(); ++c)
+            {
+                // stop reading audio from a client until its worker catches up
+                pollfd conn = {c->first, short(throttled(c->second) ? 0 : POLLIN), 0};
+                if (c->second->backlog())
+                    conn.events |= POLLOUT;
+                waiting.push_back(conn);
+            }
+
+            if (poll(&waiting[0], waiting.size(), -1) < 0 && EINTR != errno)
+                error("Failed waiting for connections");
+
+            for (size_t i = 1; i < waiting.size(); i++)
+                if (waiting[i].revents & (POLLIN | POLLERR | POLLHUP))
+                {
+                    if (all[waiting[i].fd]->receive())
+                        received(waiting[i].fd);
+                    else
+                    {
+                        closed(waiting[i].fd);
+                        all.erase(waiting[i].fd);
+                    }
+                }
+            // send whatever has been queued, closing connections that fail
+            for (std::map<int, Connection*>::iterator c = all.begin(); c != all.end(); ++c)
+                if (!c->second->flush())
+                    closed(c->first);
+            if (waiting[0].revents & POLLIN)
+            {
+                int fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+                if (fd >= 0)
+                    unknown[fd] = new Connection(fd);
+            }
+        }
+    }
+};
+const float Coordinator::kremote = 0.5;
+const size_t Coordinator::kbacklog;
+
+class Worker
+// Runs jobs from a coordinator with a pool of threads
+{
+private:
+    static const int kreport = 5000; // ms between load reports
+    static const size_t kunsent = 1 << 22; // bytes of a job's audio held before the coordinator isn't read
+
+    struct Job
+    {
+        unsigned id;
+        std::string spec;  // presets & file
+        int input;         // audio from decoder/coordinator
+        int feed;          // writes streamed audio to input
+        std::string unsent; // streamed audio the pipe hasn't taken yet
+        bool ended;        // no more audio will be streamed
+        pid_t decoder;
+    };
+
+    class JobOutput : public Output
+    // Sends a job's reports to the coordinator
+    {
+    public:
+        JobOutput(Connection& _conn, unsigned _job) : conn(_conn), job(_job) {}
+
+        void write(const char* prefix, const char* text)
+        {
+            conn.send(format("%s%u %s", prefix, job, text));
+        }
+
+    private:
+        Connection& conn;
+        const unsigned job;
+    };
+
+    Connection* coordinator;
+    const char* decoder;
+    std::deque<Job*> queue;          // jobs waiting for a thread
+    std::map<unsigned, Job*> jobs;   // all jobs, by id
+    std::mutex lock;                 // guards jobs, held whilst streamed audio is written
+    std::mutex queueLock;            // guards queue, so that a thread can take a job whilst audio is written
+    std::condition_variable ready;
+
+    void execute()
+    // Pool thread: run jobs as they arrive
+    {
+        while (true)
+        {
+            Job* job;
+            {
+                std::unique_lock<std::mutex> waiting(queueLock);
+                while (queue.empty())
+                    ready.wait(waiting);
+                job = queue.front();
+                queue.pop_front();
+            }
+
+            // spec is six presets followed by the file
+            JobOutput output(*coordinator, job->id);
+            char preset[6][32];
+            char* values[6];
+            for (int i = 0; i < 6; i++)
+                values[i] = preset[i];
+            float args[6];
+            frameNumber_t frames = 0;
+            if (6 == sscanf(job->spec.c_str(), "%31s %31s %31s %31s %31s %31s",
+                            preset[0], preset[1], preset[2], preset[3], preset[4], preset[5])
+                    && NULL == Arg::presets(values, args))
+                frames = detect(job->input, output);
+            else
+                output.write(prefixerr, "Invalid presets");
+
+            // unblocks any write of streamed audio that detection didn't want
+            close(job->input);
+            int status = 0;
+            if (job->decoder)
+                waitpid(job->decoder, &status, 0);
+            {
+                std::lock_guard<std::mutex> locked(lock);
+                if (job->feed >= 0)
+                    close(job->feed);
+                jobs.erase(job->id);
+            }
+            if (frames && WIFEXITED(status) && 0 == WEXITSTATUS(status))
+                coordinator->send(format("done@%u %u", job->id, frames));
+            else
+                coordinator->send(format("done@%u failed", job->id));
+            delete job;
+        }
+    }
+
+    void start(unsigned id, const std::string& spec)
+    // Start decoding a job & queue it for a thread
+    {
+        Job* job = new Job;
+        job->id = id;
+        job->spec = spec;
+        job->decoder = 0;
+        job->feed = -1;
+        job->ended = false;
+
+        int audio[2];
+        if (0 != pipe2(audio, O_CLOEXEC))
+            error("Could not create pipe");
+        job->input = audio[0];
+        // file follows the six presets
+        size_t at = 0;
+        for (int field = 0; field < 6 && std::string::npos != at; field++)
+            at = spec.find_first_not_of(' ', spec.find(' ', at));
+        const std::string path = (std::string::npos == at ? "" : spec.substr(at));
+
+        if ("-" == path)
+        {
+            // coordinator will stream audio, which mustn't hold up other jobs when the pipe is full
+            job->feed = audio[1];
+            fcntl(job->feed, F_SETFL, fcntl(job->feed, F_GETFL) | O_NONBLOCK);
+        }
+        else
+        {
+            // in its own process group, so that cancelling reaches the whole pipeline
+            job->decoder = fork();
+            if (0 == job->decoder)
+            {
+                setpgid(0, 0);
+                dup2(audio[1], STDOUT_FILENO);
+                execl("/bin/sh", "sh", "-c", decoder, "sh", path.c_str(), (char*)NULL);
+                _exit(127);
+            }
+            if (job->decoder > 0)
+                setpgid(job->decoder, job->decoder);
+            close(audio[1]);
+        }
+
+        {
+            std::lock_guard<std::mutex> locked(lock);
+            jobs[id] = job;
+        }
+        std::lock_guard<std::mutex> queued(queueLock);
+        queue.push_back(job);
+        ready.notify_one();
+    }
+
+    void received(const std::string& line, const std::string& data)
+    {
+        unsigned id;
+        int args = 0;
+        if (1 == sscanf(line.c_str(), "job@%u %n", &id, &args) && args)
+        {
+            start(id, line.substr(args));
+            return;
+        }
+
+        std::lock_guard<std::mutex> locked(lock);
+        std::map<unsigned, Job*>::iterator j;
+        if (1 != sscanf(line.c_str() + line.find('@') + 1, "%u", &id) || jobs.end() == (j = jobs.find(id)))
+            return;
+        Job* job = j->second;
+        if (0 == line.compare(0, 5, "data@") && job->feed >= 0)
+        {
+            job->unsent += data;
+            feed(job);
+        }
+        else if (0 == line.compare(0, 4, "end@") || 0 == line.compare(0, 7, "cancel@"))
+        {
+            // end of audio finishes the job, once the pipe has taken it
+            job->ended = true;
+            if ('c' == line[0])
+                job->unsent.clear();
+            feed(job);
+            if (job->decoder > 0 && 'c' == line[0])
+                kill(-job->decoder, SIGTERM);
+        }
+    }
+
+    void feed(Job* job)
+    // Write as much streamed audio as the job's pipe will take without blocking, closing it after
+    // the last. Called with lock held
+    {
+        while (!job->unsent.empty() && job->feed >= 0)
+        {
+            ssize_t n = write(job->feed, job->unsent.data(), job->unsent.size());
+            if (n > 0)
+                job->unsent.erase(0, n);
+            else if (EAGAIN == errno || EWOULDBLOCK == errno)
+                return;
+            else if (EINTR != errno)
+                // detection has stopped reading
+                job->unsent.clear();
+        }
+        if (job->ended && job->feed >= 0)
+        {
+            close(job->feed);
+            job->feed = -1;
+        }
+    }
+
+    static double now()
+    {
+        timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return t.tv_sec + t.tv_nsec / 1e9;
+    }
+
+public:
+    int run(const char* address, unsigned slots, const char* _decoder)
+    // Work for a coordinator until it goes away
+    {
+        decoder = _decoder;
+        signal(SIGPIPE, SIG_IGN);
+        coordinator = new Connection(connectTo(address));
+        coordinator->send(format("worker@%s %u", hostName().c_str(), slots));
+        printf("%sWorking for %s with %u slots\n", prefixinfo, address, slots);
+
+        for (unsigned i = 0; i < slots; i++)
+            std::thread(&Worker::execute, this).detach();
+
+        const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        std::string line, data;
+        std::vector<pollfd> waiting;
+        double reported = 0; // when load was last reported
+        while (true)
+        {
+            // wait for the coordinator, unless a job has too much audio waiting, & for pipes to take audio
+            waiting.clear();
+            pollfd from = {coordinator->fd, POLLIN, 0};
+            waiting.push_back(from);
+            {
+                std::lock_guard<std::mutex> locked(lock);
+                for (std::map<unsigned, Job*>::iterator j = jobs.begin(); j != jobs.end(); ++j)
+                    if (!j->second->unsent.empty() && j->second->feed >= 0)
+                    {
+                        pollfd to = {j->second->feed, POLLOUT, 0};
+                        waiting.push_back(to);
+                        if (j->second->unsent.size() > kunsent)
+                            waiting[0].events = 0;
+                    }
+            }
+            const int due = int(std::max(0.0, (reported + kreport / 1000.0 - now()) * 1000));
+            int ready = poll(&waiting[0], waiting.size(), due);
+            if (ready < 0 && EINTR != errno)
+                error("Failed waiting for coordinator");
+            if (ready > 0 && waiting[0].revents)
+            {
+                if (!coordinator->receive())
+                    error("Lost coordinator");
+                while (coordinator->next(line, data))
+                    received(line, data);
+            }
+            if (ready > 0 && waiting.size() > 1)
+            {
+                std::lock_guard<std::mutex> locked(lock);
+                for (std::map<unsigned, Job*>::iterator j = jobs.begin(); j != jobs.end(); ++j)
+                    feed(j->second);
+            }
+
+            // however busy the connection, so that jobs are placed on current figures
+            if (now() >= reported + kreport / 1000.0)
+            {
+                double load = 0;
+                getloadavg(&load, 1);
+                coordinator->send(format("load@%.2f %ld", load / cpus, cpus));
+                reported = now();
+            }
+        }
+    }
+};
+
+const size_t Worker::kunsent;
+
+int coordinate(const char* address)
+{
+    Coordinator coordinator;
+    return coordinator.run(address);
+}
+
+int work(const char* coordinator, unsigned slots, const char* decoder)
+{
+    Worker worker;
+    return worker.run(coordinator, slots, decoder);
+}
@@ -0,0 +1,211 @@
+#!/usr/bin/env python
+# Suggest a presets file for silence.py from the levels of a library of recordings.
+# v1.0 Scan recordings in parallel, caching their levels in sidecar files
+
+import os
+import subprocess
+import argparse
+import collections
+import array
+import math
+import re
+import sys
+import tempfile
+import multiprocessing
+
+kExe_Silence = '/usr/local/bin/silence'
+kUpmix_Channels = '6' # must match silence.py
+kDefaults = ['-75', '0.16', '6', '120', '120', '0.48'] # silence.py default presets
+kFull_Scale = 2 ** 31 - 1 # level of a full scale frame
+kBucket = 0.5 # dB per histogram bucket
+kBuckets = 400 # spanning level 1 to beyond full scale
+kFloor_Quantile = 0.05 # share of frames quieter than the programme floor, as silence --adapt-quantile
+kMargin = 20 # dB below the programme floor when no silence is apparent
+kSeparation = 6 # dB between silence & the programme floor for silence to be apparent
+kSilence_Runs = (0.08, 5) # secs: shorter runs are glitches, longer aren't between adverts
+kExtensions = ('.ts', '.mpg', '.mkv', '.nuv', '.mp4')
+
+def sidecar(cache, recording):
+  "Path of the levels file cached for a recording"
+  return os.path.join(cache, os.path.basename(recording) + '.levels')
+
+def readLevels(path):
+  """Reads a levels file written by silence --levels.
+     Returns the secs per frame & the level of each frame"""
+  with open(path, 'rb') as levels:
+    data = levels.read()
+  if data[:4] != b'SILV':
+    raise RuntimeError('%s is not a levels file' % path)
+  values = array.array('I')
+  if hasattr(values, 'frombytes'):
+    values.frombytes(data[4:])
+  else:  # Python 2
+    values.fromstring(data[4:])
+  version, num, den = values[0:3]
+  if version != 1:
+    raise RuntimeError('%s is from an incompatible version' % path)
+  return float(num) / den, values[3:]
+
+def bucket(level):
+  "Histogram bucket of a frame level"
+  return min(kBuckets - 1, int(20 * math.log10(level) / kBucket)) if level > 1 else 0
+
+def toDb(b):
+  "Level at the top of a histogram bucket, in dB relative to full scale"
+  return (b + 1) * kBucket - 20 * math.log10(kFull_Scale)
+
+def scan(job):
+  """Ensures a recording's levels are cached, decoding it only if they are missing or stale.
+     Returns the recording & its level histogram, or an error"""
+  recording, cache = job
+  levels = sidecar(cache, recording)
+  try:
+    if not os.path.exists(levels) or os.path.getmtime(levels) < os.path.getmtime(recording):
+      partial = levels + '.part'
+      with open(os.devnull, 'w') as devnull:
+        reader = subprocess.Popen([kExe_Silence, "--background", "--feed=" + recording],
+                    stdout=subprocess.PIPE, stderr=devnull)
+        audio = subprocess.Popen(["mythffmpeg", "-loglevel", "quiet", "-i", "pipe:0",
+                    "-f", "au", "-ac", kUpmix_Channels, "-"], stdin=reader.stdout, stdout=subprocess.PIPE)
+        detect = subprocess.Popen([kExe_Silence, "--background", "--levels=" + partial, "0"] + kDefaults,
+                    stdin=audio.stdout, stdout=devnull)
+        # only the consumers hold the pipes
+        reader.stdout.close()
+        audio.stdout.close()
+        if detect.wait() != 0:
+          raise RuntimeError('silence failed')
+        reader.wait()
+        audio.wait()
+      os.rename(partial, levels)
+    secs, values = readLevels(levels)
+    histogram = [0] * kBuckets
+    for level in values:
+      histogram[bucket(level)] += 1
+    return recording, secs, histogram, None
+  except (OSError, RuntimeError) as e:
+    return recording, 0, None, str(e)
+
+def runs(job):
+  """Measures the runs of frames below a threshold in a recording's cached levels.
+     Returns their lengths in secs"""
+  recording, cache, threshold = job
+  secs, values = readLevels(sidecar(cache, recording))
+  limit = kFull_Scale * 10 ** (threshold / 20.0)
+  lengths = []
+  run = 0
+  for level in values:
+    if level < limit:
+      run += 1
+    elif run:
+      lengths.append(run * secs)
+      run = 0
+  return [l for l in lengths if kSilence_Runs[0] <= l <= kSilence_Runs[1]]
+
+def quantile(histogram, share):
+  "Bucket that a share of the counts are at or below"
+  wanted = max(1, math.ceil(share * sum(histogram)))
+  below = 0
+  for b, count in enumerate(histogram):
+    below += count
+    if below >= wanted:
+      return b
+  return len(histogram) - 1
+
+def threshold(histogram):
+  """Suggests a silence threshold from a histogram of frame levels.
+     Silence between adverts forms a peak below the programme floor: the threshold is midway between them.
+     Returns it & the programme floor, in dB"""
+  floor = quantile(histogram, kFloor_Quantile)
+  # the quietest bucket is digital silence: look for the peak of frames merely quiet
+  low = [b for b in range(1, floor) if histogram[b]]
+  if low:
+    peak = max(low, key=lambda b: histogram[b])
+    if toDb(floor) - toDb(peak) >= kSeparation:
+      return (toDb(peak) + toDb(floor)) / 2, toDb(floor)
+  return toDb(floor) - kMargin, toDb(floor)
+
+def callsigns(recordings):
+  """Maps recordings to the callsign of their channel from the MythTV database.
+     MythTV names recordings <chanid>_<starttime>. silence.py matches presets by title or callsign,
+     so recordings whose callsign isn't known are left out"""
+  names = {}
+  try:
+    import MythTV
+    db = MythTV.MythDB()
+    for chanid in set(os.path.basename(r).split('_')[0] for r in recordings):
+      try:
+        names[chanid] = MythTV.Channel(int(chanid), db).callsign
+      except Exception:
+        pass
+  except Exception as e:
+    sys.stderr.write('No MythTV database to find callsigns: %s\n' % e)
+  channel = {}
+  for r in recordings:
+    chanid = os.path.basename(r).split('_')[0]
+    if names.get(chanid):
+      channel[r] = names[chanid]
+    else:
+      sys.stderr.write('Skipping %s: no callsign for channel %s\n' % (r, chanid))
+  return channel
+
+if __name__ == '__main__':
+  parser = argparse.ArgumentParser(description='Suggest silence presets for each channel from a library of recordings')
+  parser.add_argument('directory', nargs='+', help='Directory of recordings')
+  parser.add_argument('--presets', help='File to write the suggested presets to (default stdout)')
+  parser.add_argument('--cache', default=os.path.join(tempfile.gettempdir(), 'silence-levels'),
+                      help='Directory of level sidecar files, reused until their recording changes')
+  parser.add_argument('--workers', type=int, default=multiprocessing.cpu_count(),
+                      help='Recordings scanned at once (default one per CPU)')
+  parser.add_argument('--min-recordings', type=int, default=3,
+                      help='Recordings of a channel needed to suggest its presets (default 3)')
+  args = parser.parse_args()
+
+  if not os.path.isdir(args.cache):
+    os.makedirs(args.cache)
+  recordings = sorted(os.path.join(d, f) for d in args.directory for f in os.listdir(d)
+                      if f.lower().endswith(kExtensions))
+  channel = callsigns(recordings)
+  recordings = [r for r in recordings if r in channel]
+  sys.stderr.write('Scanning %d recordings with %d workers\n' % (len(recordings), args.workers))
+
+  # levels of each channel
+  pool = multiprocessing.Pool(args.workers)
+  histograms = {}
+  members = collections.defaultdict(list)
+  window = {}
+  for recording, secs, histogram, err in pool.imap_unordered(scan, [(r, args.cache) for r in recordings]):
+    if err:
+      sys.stderr.write('Skipping %s: %s\n' % (recording, err))
+      continue
+    name = channel[recording]
+    total = histograms.setdefault(name, [0] * kBuckets)
+    for b in range(kBuckets):
+      total[b] += histogram[b]
+    members[name].append(recording)
+    window[name] = secs
+
+  # lengths of silences at each channel's threshold
+  suggestions = []
+  for name in sorted(members):
+    if len(members[name]) < args.min_recordings:
+      sys.stderr.write('Skipping %s: only %d recordings\n' % (name, len(members[name])))
+      continue
+    thresh, floor = threshold(histograms[name])
+    lengths = sorted(l for found in pool.map(runs, [(r, args.cache, thresh) for r in members[name]])
+                     for l in found)
+    # the shortest silences between adverts, but never less than a frame
+    minquiet = lengths[len(lengths) // 10] if lengths else float(kDefaults[1])
+    minquiet = max(window[name], round(minquiet, 2))
+    median = lengths[len(lengths) // 2] if lengths else 0
+    suggestions.append((name, thresh, minquiet, floor, median, len(members[name]), len(lengths)))
+  pool.close()
+
+  out = open(args.presets, 'w') if args.presets else sys.stdout
+  out.write('# Suggested by silence-calibrate. Name regex, threshold, minquiet, mindetect, minbreak, maxsep, pad\n')
+  out.write('# Empty values take the silence.py default\n')
+  for name, thresh, minquiet, floor, median, count, silences in suggestions:
+    out.write('# %s: %d recordings, programme floor %.1f dB, %d silences, median %.2f secs\n'
+              % (name, count, floor, silences, median))
+    out.write('^%s$, %.1f, %.2f, , , ,\n' % (re.escape(name), thresh, minquiet))
+  if args.presets:
+    out.close()
@@ -0,0 +1,266 @@
+#!/usr/bin/env python
+# Find how many live streams a host can flag at once, in each way silence can run them.
+# v1.0 Ramp simulated streams through processes, the --streams loop & a worker's thread pool
+
+import os
+import subprocess
+import argparse
+import array
+import random
+import socket
+import struct
+import sys
+import tempfile
+import threading
+import time
+
+kExe_Silence = '/usr/local/bin/silence'
+kDefaults = ['-75', '0.16', '6', '120', '120', '0.48'] # silence.py default presets
+kChunk = 0.1 # secs of audio written at a time
+kAmplitudes = (0, 200, 800, 3000, 9000, 20000) # of programme segments, 0 for silences
+kModels = ('process', 'streams', 'pool')
+
+def header(rate, channels):
+  "AU header of a 16 bit stream of unknown length"
+  return struct.pack('>6I', 0x2e736e64, 24, 0xffffffff, 3, rate, channels)
+
+def programme(seed, rate, channels):
+  """Yields chunks of a synthetic recording: segments of varying loudness, short silences and
+     breaks of clustered silences. Each stream differs, so that --streams doesn't share levels"""
+  rng = random.Random(seed)
+  samples = int(rate * kChunk)
+  chunks = {}
+  for amplitude in kAmplitudes:
+    values = array.array('h', [amplitude, -amplitude] * (samples * channels // 2))
+    if sys.byteorder == 'little':
+      values.byteswap()  # AU is big endian
+    chunks[amplitude] = values.tobytes() if hasattr(values, 'tobytes') else values.tostring()
+  while True:
+    if rng.random() < 0.02:
+      # an advert break: a silence between each advert
+      for advert in range(rng.randint(4, 8)):
+        for i in range(rng.randint(2, 5)):
+          yield chunks[0]
+        for i in range(rng.randint(100, 300)):
+          yield chunks[rng.choice(kAmplitudes[2:])]
+    amplitude = 0 if rng.random() < 0.05 else rng.choice(kAmplitudes[1:])
+    for i in range(rng.randint(5, 100)):
+      yield chunks[amplitude]
+
+class Feed(threading.Thread):
+  """Writes a stream at the simulated rate, measuring how far writes fall behind it.
+     A stream that silence doesn't keep up with blocks once the buffers between them fill"""
+  def __init__(self, sink, seed, args):
+    threading.Thread.__init__(self)
+    self.sink = sink  # takes bytes
+    self.seed = seed
+    self.args = args
+    self.lag = 0.0    # secs writing fell furthest behind
+    self.closed = None
+
+  def run(self):
+    args = self.args
+    audio = programme(self.seed, args.rate, args.channels)
+    start = time.time()
+    chunks = int(args.secs * args.speed / kChunk)
+    for n in range(chunks):
+      due = start + n * kChunk / args.speed
+      now = time.time()
+      if due > now:
+        time.sleep(due - now)
+      self.sink(next(audio))
+      self.lag = max(self.lag, time.time() - due - kChunk / args.speed)
+    self.closed = time.time()
+
+class Sampler(threading.Thread):
+  "Samples the CPU secs & resident MB of processes until stopped"
+  def __init__(self):
+    threading.Thread.__init__(self)
+    self.pids = []
+    self.cpu = {}
+    self.rss = {}
+    self.done = False
+    self.tick = float(os.sysconf('SC_CLK_TCK'))
+
+  def run(self):
+    while not self.done:
+      for pid in list(self.pids):
+        try:
+          with open('/proc/%d/stat' % pid) as stat:
+            fields = stat.read().rsplit(')', 1)[1].split()
+          # utime & stime are fields 14 & 15, counting from the pid
+          self.cpu[pid] = (int(fields[11]) + int(fields[12])) / self.tick
+          self.rss[pid] = max(self.rss.get(pid, 0), int(fields[21]) * os.sysconf('SC_PAGE_SIZE') / 1048576.0)
+        except (IOError, OSError, IndexError, ValueError):
+          pass
+      time.sleep(0.1)
+
+def drain(stream):
+  "Reads reports until the end"
+  for line in iter(stream.readline, b''):
+    pass
+
+def runProcesses(n, args, sampler):
+  """A silence process per stream, as silence.py flags recordings.
+     Returns the feeds & when each stream finished"""
+  procs = [subprocess.Popen([args.exe, '--live-start=%d' % time.time(), '0'] + args.presets,
+                            stdin=subprocess.PIPE, stdout=subprocess.PIPE) for i in range(n)]
+  sampler.pids += [p.pid for p in procs]
+  feeds = []
+  for i, p in enumerate(procs):
+    p.stdin.write(header(args.rate, args.channels))
+    feeds.append(Feed(p.stdin.write, args.seed + i, args))
+  readers = [threading.Thread(target=drain, args=(p.stdout,)) for p in procs]
+  for t in feeds + readers:
+    t.start()
+  finished = []
+  for f, p, r in zip(feeds, procs, readers):
+    f.join()
+    p.stdin.close()
+    r.join()
+    p.wait()
+    finished.append(time.time())
+  return feeds, finished
+
+def runStreams(n, args, sampler):
+  "One silence detecting every stream, each from a named pipe"
+  directory = tempfile.mkdtemp()
+  fifos = [os.path.join(directory, 'stream%d.au' % i) for i in range(n)]
+  for fifo in fifos:
+    os.mkfifo(fifo)
+  proc = subprocess.Popen([args.exe, '--streams'] + args.presets + fifos, stdout=subprocess.PIPE)
+  sampler.pids.append(proc.pid)
+  # silence opens the streams in turn & reads each header before opening the next
+  sinks = []
+  for fifo in fifos:
+    sink = open(fifo, 'wb', 0)
+    sink.write(header(args.rate, args.channels))
+    sinks.append(sink)
+  feeds = [Feed(s.write, args.seed + i, args) for i, s in enumerate(sinks)]
+  reader = threading.Thread(target=drain, args=(proc.stdout,))
+  for t in feeds + [reader]:
+    t.start()
+  for f, s in zip(feeds, sinks):
+    f.join()
+    s.close()
+  reader.join()
+  proc.wait()
+  for fifo in fifos:
+    os.remove(fifo)
+  os.rmdir(directory)
+  # streams only finish together
+  return feeds, [time.time()] * n
+
+class Job(object):
+  "A job streamed to a silence coordinator, as silence.py --coordinator --stream submits them"
+  def __init__(self, port, args):
+    self.conn = socket.create_connection(('127.0.0.1', port))
+    self.replies = self.conn.makefile('rb')
+    self.conn.sendall(('job@%s %s -\n' % (socket.gethostname(), ' '.join(args.presets))).encode())
+    self.id = None
+    self.started = threading.Event()
+    self.finished = None
+
+  def send(self, block):
+    self.conn.sendall(('data@%s %d\n' % (self.id, len(block))).encode() + block)
+
+  def follow(self):
+    "Reads replies until the job is done"
+    for line in self.replies:
+      flag, info = line.decode('utf-8', 'replace').split('@', 1)
+      if flag == 'queued':
+        self.id = info.strip()
+      elif flag == 'started':
+        self.started.set()
+      elif flag == 'done':
+        break
+    self.finished = time.time()
+    self.started.set()
+
+def runPool(n, args, sampler):
+  "A coordinator and a worker running a thread per stream"
+  probe = socket.socket()
+  probe.bind(('127.0.0.1', 0))
+  port = probe.getsockname()[1]
+  probe.close()
+  devnull = open(os.devnull, 'w')
+  coordinator = subprocess.Popen([args.exe, '--coordinator=%d' % port], stdout=devnull)
+  time.sleep(0.5)
+  worker = subprocess.Popen([args.exe, '--worker=127.0.0.1:%d' % port, '--slots=%d' % n], stdout=devnull)
+  sampler.pids += [coordinator.pid, worker.pid]
+  time.sleep(0.5)
+  jobs = [Job(port, args) for i in range(n)]
+  followers = [threading.Thread(target=j.follow) for j in jobs]
+  for t in followers:
+    t.start()
+  for j in jobs:
+    j.started.wait()
+    j.send(header(args.rate, args.channels))
+  feeds = [Feed(j.send, args.seed + i, args) for i, j in enumerate(jobs)]
+  for f in feeds:
+    f.start()
+  for f, j in zip(feeds, jobs):
+    f.join()
+    j.conn.sendall(('end@%s\n' % j.id).encode())
+  for t in followers:
+    t.join()
+  for j in jobs:
+    j.conn.close()
+  time.sleep(0.2) # final samples
+  worker.terminate()
+  coordinator.terminate()
+  worker.wait()
+  coordinator.wait()
+  devnull.close()
+  return feeds, [j.finished for j in jobs]
+
+def measure(model, n, args):
+  "Runs n streams. Returns the lag of each & the CPU % of a core & MB per stream"
+  sampler = Sampler()
+  sampler.start()
+  feeds, finished = {'process': runProcesses, 'streams': runStreams, 'pool': runPool}[model](n, args, sampler)
+  sampler.done = True
+  sampler.join()
+  # reports still buffered when the input ended are lag too
+  lags = [max(f.lag, end - f.closed) for f, end in zip(feeds, finished)]
+  media = args.secs * args.speed
+  return lags, 100 * sum(sampler.cpu.values()) / media / n, sum(sampler.rss.values()) / n
+
+if __name__ == '__main__':
+  parser = argparse.ArgumentParser(description='Find how many live streams silence can flag at once')
+  parser.add_argument('presets', nargs='*', default=kDefaults,
+                      help='threshold minquiet mindetect minlength maxsep pad (default silence.py defaults)')
+  parser.add_argument('--model', action='append', choices=kModels,
+                      help='Way of running streams, may be repeated (default all): process per stream, '
+                           'silence --streams, or a silence --worker thread per stream')
+  parser.add_argument('--lag', type=float, default=5, help='Secs a stream may fall behind (default 5)')
+  parser.add_argument('--secs', type=float, default=60, help='Secs each step runs for (default 60)')
+  parser.add_argument('--speed', type=float, default=1, help='Multiple of realtime streams arrive at (default 1)')
+  parser.add_argument('--start', type=int, default=1, help='Streams at the first step (default 1)')
+  parser.add_argument('--step', type=int, default=0, help='Streams added each step (default doubles them)')
+  parser.add_argument('--max', type=int, default=256, help='Most streams tried (default 256)')
+  parser.add_argument('--rate', type=int, default=48000, help='Sample rate of the streams (default 48000)')
+  parser.add_argument('--channels', type=int, default=6, help='Channels of the streams (default 6, as silence.py)')
+  parser.add_argument('--seed', type=int, default=1, help='Of the synthetic programmes (default 1)')
+  parser.add_argument('--exe', default=kExe_Silence, help='silence executable (default %s)' % kExe_Silence)
+  args = parser.parse_args()
+  if len(args.presets) != 6:
+    parser.error('presets must be all six of threshold minquiet mindetect minlength maxsep pad')
+
+  for model in args.model or kModels:
+    sys.stdout.write('%s: streams, lag median/max secs, CPU %% of a core per realtime stream, MB per stream\n' % model)
+    sys.stdout.flush()
+    sustained = 0
+    # --streams needs at least two
+    n = max(2, args.start) if model == 'streams' else args.start
+    while n <= args.max:
+      lags, cpu, rss = measure(model, n, args)
+      ok = max(lags) <= args.lag
+      sys.stdout.write('  %4d  %6.2f %6.2f  %6.2f%%  %6.1f  %s\n'
+                       % (n, sorted(lags)[len(lags) // 2], max(lags), cpu, rss, 'ok' if ok else 'LAGGING'))
+      sys.stdout.flush()
+      if not ok:
+        break
+      sustained = n
+      n = n + args.step if args.step else 2 * n
+    sys.stdout.write('%s: sustains %d streams%s\n' % (model, sustained, '' if n <= args.max else ' or more'))
@@ -0,0 +1,176 @@
+#!/usr/bin/env python
+# Simulate live recordings from a finished one to benchmark silence in live mode, offline.
+# v1.0 Grow recordings as a recorder would, measuring cut latency, idle handling & CPU per stream
+
+import os
+import subprocess
+import argparse
+import bisect
+import random
+import re
+import resource
+import shlex
+import struct
+import sys
+import tempfile
+import threading
+import time
+
+kExe_Silence = '/usr/local/bin/silence'
+kDecoder = 'mythffmpeg -loglevel quiet -i pipe:0 -f au -ac 6 -' # as silence.py
+kDefaults = ['-75', '0.16', '6', '120', '120', '0.48'] # silence.py default presets
+kTS_Packet = 188 # recorders write whole transport stream packets
+kAU_Bytes = {2: 1, 3: 2, 4: 3, 5: 4, 6: 4, 7: 8} # bytes per sample of AU encodings
+kCut = re.compile(r'cut@\S\s+Cut\s+(-?\d+)-\s*(-?\d+)')
+
+def duration(source):
+  "Secs of media in an AU recording, or None for other formats"
+  with open(source, 'rb') as f:
+    magic, offset, _, encoding, rate, channels = struct.unpack('>6I', f.read(24))
+  if magic != 0x2e736e64 or encoding not in kAU_Bytes:
+    return None
+  return float(os.path.getsize(source) - offset) / (kAU_Bytes[encoding] * rate * channels)
+
+class Recorder(threading.Thread):
+  """Copies a recording to a target file as a recorder writes it: a chunk every interval, with jitter,
+     and stalls after which the buffered backlog is written at once. Logs when each byte was written"""
+  def __init__(self, source, target, args, seed):
+    threading.Thread.__init__(self)
+    self.source = source
+    self.target = target
+    self.args = args
+    self.random = random.Random(seed)
+    self.size = os.path.getsize(source)
+    self.written = [0]   # bytes written by each write
+    self.times = [0.0]   # when each write finished
+    self.stalls = 0
+    self.began = self.closed = None
+
+  def run(self):
+    args = self.args
+    rate = self.size / args.duration * args.speed # bytes per sec
+    with open(self.source, 'rb') as source:
+      target = open(self.target, 'wb')
+      self.began = time.time()
+      total = 0
+      while total < self.size:
+        # write everything due by now, in whole packets as the recorder's buffer is flushed
+        wait = args.interval * (1 + self.random.uniform(-args.jitter, args.jitter))
+        if self.random.random() < args.stall_rate:
+          wait += self.random.expovariate(1.0 / args.stall)
+          self.stalls += 1
+        time.sleep(max(0, wait))
+        due = min(self.size, int((time.time() - self.began) * rate) // kTS_Packet * kTS_Packet)
+        if due <= total:
+          continue
+        target.write(source.read(due - total))
+        target.flush()
+        total = due
+        self.written.append(total)
+        self.times.append(time.time() - self.began)
+      target.close()
+      self.closed = time.time() - self.began
+
+  def writtenAt(self, secs):
+    "Time since the start that media at secs had been written"
+    needed = secs / self.args.duration * self.size
+    i = bisect.bisect_left(self.written, needed)
+    return self.times[min(i, len(self.times) - 1)]
+
+class Stream(object):
+  "A simulated recording flagged by the silence live pipeline"
+  def __init__(self, source, index, args):
+    self.args = args
+    self.target = os.path.join(args.directory, 'silence-simulate-%d-%d%s'
+                               % (os.getpid(), index, os.path.splitext(source)[1]))
+    self.recorder = Recorder(source, self.target, args, args.seed + index)
+    self.cuts = [] # (start, end, secs from its end being written to its delivery)
+    self.ended = None
+
+  def run(self):
+    "Records & flags the stream, returning when the pipeline has finished"
+    args = self.args
+    open(self.target, 'wb').close()
+    self.recorder.start()
+    idle = ['--idle=%g' % args.idle]
+    feed = subprocess.Popen([args.exe, '--feed=' + self.target, '--follow'] + idle,
+                            stdout=subprocess.PIPE, stderr=open(os.devnull, 'w'))
+    audio = subprocess.Popen(shlex.split(args.decoder), stdin=feed.stdout, stdout=subprocess.PIPE)
+    flag = subprocess.Popen([args.exe, '--live-start=%d' % time.time()] + idle + args.option
+                            + ['%d' % feed.pid] + args.presets, stdin=audio.stdout, stdout=subprocess.PIPE)
+    # only the consumers hold the pipes
+    feed.stdout.close()
+    audio.stdout.close()
+    for line in iter(flag.stdout.readline, b''):
+      arrived = time.time() - (self.recorder.began or time.time())
+      match = kCut.search(line.decode('utf-8', 'replace'))
+      if match:
+        start, end = int(match.group(1)), int(match.group(2))
+        # the cut is delivered once the cluster completes, maxsep beyond its last silence
+        self.cuts.append((start, end, arrived - self.recorder.writtenAt(max(0, end) / args.fps)))
+    flag.wait()
+    finished = time.time() - self.recorder.began
+    audio.wait()
+    feed.wait()
+    self.recorder.join()
+    # negative if a stall exceeded the idle timeout
+    self.ended = finished - self.recorder.closed
+    if not args.keep:
+      os.remove(self.target)
+
+def percentile(values, share):
+  ordered = sorted(values)
+  return ordered[min(len(ordered) - 1, int(share * len(ordered)))]
+
+if __name__ == '__main__':
+  parser = argparse.ArgumentParser(description='Benchmark silence flagging simulated live recordings')
+  parser.add_argument('source', help='Finished recording to replay')
+  parser.add_argument('presets', nargs='*', default=kDefaults,
+                      help='threshold minquiet mindetect minlength maxsep pad (default silence.py defaults)')
+  parser.add_argument('--streams', type=int, default=1, help='Recordings simulated at once (default 1)')
+  parser.add_argument('--speed', type=float, default=1, help='Multiple of realtime to record at (default 1)')
+  parser.add_argument('--interval', type=float, default=0.5, help='Secs between recorder writes (default 0.5)')
+  parser.add_argument('--jitter', type=float, default=0.3, help='Variation of the interval, as a share (default 0.3)')
+  parser.add_argument('--stall-rate', type=float, default=0.005, help='Chance a write stalls (default 0.005)')
+  parser.add_argument('--stall', type=float, default=2, help='Mean secs of a stall (default 2)')
+  parser.add_argument('--idle', type=float, default=30, help='silence idle timeout in secs (default 30)')
+  parser.add_argument('--seed', type=int, default=1, help='Of the write timing, for reproducible runs (default 1)')
+  parser.add_argument('--duration', type=float, help='Secs of media in the source (found for AU sources)')
+  parser.add_argument('--fps', type=float, default=25, help='Video frame rate cuts are reported in (default 25)')
+  parser.add_argument('--decoder', default=kDecoder, help='Command extracting AU audio from stdin (default mythffmpeg)')
+  parser.add_argument('--option', action='append', default=[], help='Extra option for silence, may be repeated')
+  parser.add_argument('--exe', default=kExe_Silence, help='silence executable (default %s)' % kExe_Silence)
+  parser.add_argument('--directory', default=tempfile.gettempdir(), help='Where recordings are grown (default tmp)')
+  parser.add_argument('--keep', action='store_true', help='Keep the grown recordings')
+  args = parser.parse_args()
+  if len(args.presets) != 6:
+    parser.error('presets must be all six of threshold minquiet mindetect minlength maxsep pad')
+  args.duration = args.duration or duration(args.source)
+  if not args.duration:
+    parser.error('--duration is needed for sources that are not AU')
+
+  sys.stdout.write('Recording %d streams of %.0f secs at %gx realtime\n' % (args.streams, args.duration, args.speed))
+  sys.stdout.flush()
+  streams = [Stream(args.source, i, args) for i in range(args.streams)]
+  threads = [threading.Thread(target=s.run) for s in streams]
+  for t in threads:
+    t.start()
+  for t in threads:
+    t.join()
+
+  # cuts are delivered maxsep after their last silence at the earliest, in media time
+  floor = float(args.presets[4]) / args.speed
+  latencies = []
+  for i, s in enumerate(streams):
+    sys.stdout.write('Stream %d: %d writes, %d stalls, finished %.1f secs %s the recording closed\n'
+                     % (i, len(s.recorder.written) - 1, s.recorder.stalls, abs(s.ended),
+                        'after' if s.ended >= 0 else 'BEFORE'))
+    for start, end, latency in s.cuts:
+      sys.stdout.write('  cut %6d-%6d delivered %.2f secs after its end was written\n' % (start, end, latency))
+      latencies.append(latency)
+  usage = resource.getrusage(resource.RUSAGE_CHILDREN)
+  cpu = usage.ru_utime + usage.ru_stime
+  sys.stdout.write('Cut latency: %d cuts, %.2f secs median, %.2f secs max, at least %.2f from maxsep\n'
+                   % (len(latencies), percentile(latencies, 0.5) if latencies else 0, max(latencies or [0]), floor))
+  sys.stdout.write('CPU: %.2f secs per stream, %.2f%% of a core per realtime stream\n'
+                   % (cpu / args.streams, 100 * cpu / args.streams / args.duration))
@@ -0,0 +1,270 @@
+#!/usr/bin/env python
+# Stress silence with pathological streams, failing if it uses more resources than the limits.
+# v1.0 Flickering, near silent & trickled streams. Peak RSS, page faults, output, CPU & latency
+# v1.1 Allocations counted by silence --stats. Flat memory caps for near silence, looser latency
+
+import os
+import re
+import subprocess
+import argparse
+import array
+import mmap
+import struct
+import sys
+import tempfile
+import threading
+import time
+
+kRate = 8000 # Hz, mono 16 bit
+kFrame = kRate // 25 # samples per frame, as the default window
+kLoud = 3000 # amplitude of programme frames
+kQuiet = 3 # amplitude of near silent frames, below the default threshold of -75 dB
+kPresets = ['-75', '0.04', '6', '120', '120', '0.48'] # shortest silences are a frame
+# level ring header: magic, version, ... & at kRing_Written the count of records published. The offset
+# is only valid for this version, so others are refused
+kRing_Magic = b'SILL'
+kRing_Version = 4
+kRing_Written = 32
+kRing_Size = 45000 # levels a ring holds
+
+# scenario: (description, hours of input by default, quiet frames, loud frames in each cycle)
+kScenarios = {
+  'flicker': ('Crosses the threshold every other frame: a silence & report every 2 frames', 1, 1, 1),
+  'nearsilence': ('Near silence broken by a loud frame: one cluster that never completes', 6, 10, 1),
+  'trickle': ('A frame at a time, as a live recording that barely keeps up', 0.1, 50, 200),
+  'replay': ('A level ring numbered from beyond its size, as a replay leaves it, followed by a reader', 0.1, 50, 200),
+}
+
+# Regression limits, a few times those measured. RSS (MB beyond kRss_Base), page faults, allocations (made
+# with new, as silence --stats reports) & output (bytes) grow with the silences found, so are per hour of input
+# where kPer_Hour lists them. A near silence is one cluster holding every silence till the end, so its memory
+# is capped flat, sized for the default hours: longer runs show the growth. CPU is usecs per frame. Latency
+# (ms) is of a scheduler as much as of silence, so its limits are loose enough for a loaded host
+kRss_Base = 8
+kPer_Hour = {
+  'flicker': ('rss', 'faults', 'allocations', 'output'),
+  'nearsilence': ('output',),
+  'trickle': ('rss', 'faults', 'output'),
+  'replay': ('rss', 'faults', 'output'),
+}
+kLimits = {
+  'flicker': {'rss': 4, 'faults': 2500, 'allocations': 60000, 'output': 8e6, 'cpu': 10},
+  'nearsilence': {'rss': 4, 'faults': 2500, 'allocations': 100000, 'output': 1.5e6, 'cpu': 10},
+  'trickle': {'rss': 4, 'faults': 10000, 'allocations': 500, 'output': 1e5, 'cpu': 50, 'p99': 20, 'max': 1000},
+  'replay': {'rss': 4, 'faults': 10000, 'allocations': 500, 'output': 1e5, 'cpu': 10, 'unread': 0},
+}
+
+def frame(amplitude):
+  "A frame of samples alternating about 0"
+  samples = array.array('h', [amplitude, -amplitude] * (kFrame // 2))
+  if sys.byteorder == 'little':
+    samples.byteswap()  # AU is big endian
+  return samples.tostring() if not hasattr(samples, 'tobytes') else samples.tobytes()
+
+def header():
+  "AU header of a 16 bit stream of unknown length"
+  return struct.pack('>6I', 0x2e736e64, 24, 0xffffffff, 3, kRate, 1)
+
+def cycle(quiet, loud):
+  "Frames of a cycle of a scenario"
+  return [frame(kQuiet)] * quiet + [frame(kLoud)] * loud
+
+def feed(stream, frames, quiet, loud):
+  "Writes a scenario to a pipe, as fast as it will take it"
+  pattern = b''.join(cycle(quiet, loud))
+  period = quiet + loud
+  chunk = pattern * max(1, 2000 // period)
+  stream.write(header())
+  written = 0
+  while written < frames:
+    n = min(len(chunk) // (2 * kFrame), frames - written)
+    stream.write(chunk[:n * 2 * kFrame])
+    written += n
+  stream.close()
+
+def mapRing(path):
+  """Maps a level ring once silence has written its header, or returns None.
+     Fails if the ring's layout isn't the one known"""
+  if not os.path.exists(path) or os.path.getsize(path) <= kRing_Written + 8:
+    return None
+  with open(path, 'r+b') as f:
+    ring = mmap.mmap(f.fileno(), 0)
+  # the magic is written after the rest of the header
+  if ring[:4] != kRing_Magic:
+    ring.close()
+    return None
+  version = struct.unpack_from('=I', ring, 4)[0]
+  if version != kRing_Version:
+    raise RuntimeError('level ring is version %d, this script reads version %d' % (version, kRing_Version))
+  return ring
+
+def trickle(stream, frames, quiet, loud, ring):
+  """Writes a scenario a frame at a time, waiting for silence to publish the level of each.
+     Returns the secs from writing each frame to its level being published"""
+  pattern = cycle(quiet, loud)
+  stream.write(header())
+  stream.flush()
+  latency = []
+  published = None
+  for n in range(frames):
+    start = time.time()
+    stream.write(pattern[n % len(pattern)])
+    stream.flush()
+    while True:
+      if published is None:
+        published = mapRing(ring)
+      if published is not None and struct.unpack_from('=Q', published, kRing_Written)[0] > n:
+        break
+      time.sleep(0.00002)
+    latency.append(time.time() - start)
+  stream.close()
+  return latency
+
+def follow(exe, ring, result, timeout=30):
+  """Reads a level ring with silence --read-ring until its writer finishes, counting the levels in result.
+     The reader is killed if it hasn't finished within timeout secs"""
+  deadline = time.time() + timeout
+  while mapRing(ring) is None:
+    if time.time() > deadline:
+      return
+    time.sleep(0.001)
+  reader = subprocess.Popen([exe, '--read-ring=' + ring], stdout=subprocess.PIPE)
+  timer = threading.Timer(max(0, deadline - time.time()), reader.kill)
+  timer.start()
+  for line in iter(reader.stdout.readline, b''):
+    if not line.startswith(b'err@'):
+      result['read'] += 1
+  reader.wait()
+  timer.cancel()
+
+class Watcher(threading.Thread):
+  """Samples the peak RSS of a process until it exits.
+     Its rusage would include the RSS of this process, which it was forked from"""
+  def __init__(self, pid):
+    threading.Thread.__init__(self)
+    self.status = '/proc/%d/status' % pid
+    self.peak = 0 # kB
+    self.done = False
+
+  def run(self):
+    while not self.done:
+      try:
+        with open(self.status) as status:
+          for line in status:
+            if line.startswith('VmHWM:'):
+              self.peak = max(self.peak, int(line.split()[1]))
+      except (IOError, OSError, ValueError):
+        pass
+      time.sleep(0.001)
+
+def percentile(values, share):
+  ordered = sorted(values)
+  return ordered[min(len(ordered) - 1, int(share * len(ordered)))]
+
+def run(exe, name, hours):
+  "Runs silence on a scenario. Returns its measurements"
+  description, _, quiet, loud = kScenarios[name]
+  frames = int(hours * 3600 * 25)
+  ring = os.path.join(tempfile.gettempdir(), 'silence-stress-%d.ring' % os.getpid())
+  if os.path.exists(ring):
+    os.remove(ring)
+  options = ['--level-ring=' + ring] if name in ('trickle', 'replay') else []
+  replay = None
+  if name == 'replay':
+    # the input continues a recording that is longer than the ring
+    handle, replay = tempfile.mkstemp(suffix='.silences')
+    os.write(handle, ('# window 1/25\nframes %d\n' % (kRing_Size + 5000)).encode())
+    os.close(handle)
+    options.append('--replay=' + replay)
+  output = tempfile.TemporaryFile()
+  start = time.time()
+  proc = subprocess.Popen([exe, '--stats'] + options + ['0'] + kPresets, stdin=subprocess.PIPE, stdout=output,
+                          stderr=output)
+  watcher = Watcher(proc.pid)
+  watcher.start()
+  latency = []
+  levels = {'read': 0}
+  reader = threading.Thread(target=follow, args=(exe, ring, levels)) if name == 'replay' else None
+  if reader:
+    reader.start()
+  if name == 'trickle':
+    latency = trickle(proc.stdin, frames, quiet, loud, ring)
+  else:
+    writer = threading.Thread(target=feed, args=(proc.stdin, frames, quiet, loud))
+    writer.start()
+    writer.join()
+  _, status, usage = os.wait4(proc.pid, 0)
+  proc.returncode = status
+  watcher.done = True
+  watcher.join()
+  wall = time.time() - start
+  if reader:
+    reader.join()
+    os.remove(replay)
+  output.seek(0, os.SEEK_END)
+  size = output.tell()
+  output.seek(max(0, size - 4096))
+  stats = re.search(br'Made (\d+) allocations', output.read())
+  if os.path.exists(ring):
+    os.remove(ring)
+
+  result = {
+    'frames': frames,
+    'wall': wall,
+    'rss': watcher.peak / 1024.0,                 # MB
+    'faults': usage.ru_minflt + usage.ru_majflt,
+    'output': size,                               # bytes
+    'allocations': int(stats.group(1)) if stats else float('inf'),
+    'cpu': (usage.ru_utime + usage.ru_stime) * 1e6 / frames, # usecs per frame
+    'status': status,
+  }
+  if reader:
+    result['unread'] = frames - levels['read']
+  if latency:
+    result['p50'] = percentile(latency, 0.5) * 1000  # ms
+    result['p99'] = percentile(latency, 0.99) * 1000
+    result['max'] = max(latency) * 1000
+  return result
+
+def check(name, result, hours):
+  "Returns the measurements beyond their limits"
+  failures = []
+  for measure, limit in sorted(kLimits[name].items()):
+    allowed = limit * hours if measure in kPer_Hour[name] else limit
+    if measure == 'rss':
+      allowed += kRss_Base
+    if result[measure] > allowed:
+      failures.append('%s %.1f exceeds %.1f' % (measure, result[measure], allowed))
+  if result['status'] != 0:
+    failures.append('exit status %d' % result['status'])
+  return failures
+
+if __name__ == '__main__':
+  parser = argparse.ArgumentParser(description='Stress silence with pathological streams')
+  parser.add_argument('scenario', nargs='*', help='Scenarios to run (default all): ' + ', '.join(sorted(kScenarios)))
+  parser.add_argument('--exe', default='./silence', help='silence executable (default ./silence)')
+  parser.add_argument('--hours', type=float, help='Hours of input of each scenario (default depends on scenario)')
+  parser.add_argument('--no-limits', action='store_true', help='Report the measurements without failing')
+  args = parser.parse_args()
+
+  failed = False
+  for name in args.scenario or sorted(kScenarios):
+    if name not in kScenarios:
+      parser.error('unknown scenario %s' % name)
+    hours = args.hours or kScenarios[name][1]
+    sys.stdout.write('%s: %s, %.1f hours\n' % (name, kScenarios[name][0], hours))
+    sys.stdout.flush()
+    result = run(args.exe, name, hours)
+    sys.stdout.write('  %d frames in %.1f secs, peak RSS %.1f MB, %d page faults, %.0f allocations, %d bytes output, '
+                     '%.1f usecs CPU/frame\n' % (result['frames'], result['wall'], result['rss'], result['faults'],
+                                                 result['allocations'], result['output'], result['cpu']))
+    if 'p50' in result:
+      sys.stdout.write('  latency %.3f ms median, %.3f ms 99th percentile, %.3f ms max\n'
+                       % (result['p50'], result['p99'], result['max']))
+    if 'unread' in result:
+      sys.stdout.write('  %d levels unread by a reader of the ring\n' % result['unread'])
+    failures = [] if args.no_limits else check(name, result, hours)
+    for failure in failures:
+      sys.stdout.write('  FAILED: %s\n' % failure)
+    failed = failed or bool(failures)
+  sys.exit(1 if failed else 0)
@@ -5,57 +5,303 @@
 // v4.0 Kill process argv[1] when idle for 30 seconds.
 // v4.1 Fix averaging overflow
 // v4.2 Unblock the alarm signal so the job actually finishes.
+// v5.0 Detect idle input by polling the pipe instead of alarm(). Configurable idle time & action.
+// v5.1 Export & replay silence lists so that a backlog can be scanned in parallel.
+// v5.2 Degrade analysis when falling behind a live recording.
+// v5.3 Optional CPU budget, idle scheduling & idle I/O priority.
+// v5.4 Read files without filling the page cache. Feed mode to replace tail/dd.
+// v5.5 Detector state can be snapshotted & restored to move a live job.
+// v5.6 Coordinator & worker modes distribute jobs across hosts.
+// v5.7 Multi-stream mode shares analysis between recordings of the same broadcast.
+// v5.8 Export quiet frames down to a floor so that a recording can be reclustered without decoding.
+// v5.9 Presets can be changed whilst running, optionally reclustering the silences so far.
+// v5.10 Sparse scanning of finished recordings only analyses the neighbourhood of quiet frames.
+// v5.11 Analysis window is independent of the video frame rate, which is configurable.
+// v5.12 Optionally adapt the threshold to the programme floor, estimated as the recording is read.
+// v5.13 Optionally write the level of every frame to a sidecar file, for silence-calibrate.
+// v5.14 Optional hysteresis ends silences at a higher level. Detect at several thresholds in one pass.
+// v5.15 Recluster from a levels file, finding silences 64 frames at a time.
+// v5.16 Optionally publish reports as records in a shared memory ring.
+// v5.17 Optionally publish the level of every frame in a shared memory ring.
+// v5.18 Flight recorder of the last 30 mins, dumped on SIGUSR2, suspicious cuts or exit.
+// v5.19 Static tracing probes at frame batches, silences, cluster states, cuts & input stalls.
+// v5.20 Feed only the audio of an MPEG-TS, as TS packets or its elementary stream.
 // Public domain. Requires libsndfile
 // Detects commercial breaks using clusters of audio silences
 
 #include <cstdlib>
+#include <cstdio>
+#include <cstring>
 #include <cmath>
 #include <cerrno>
 #include <climits>
+#include <ctime>
+#include <algorithm>
 #include <deque>
+#include <vector>
+#include <new>
 #include <sndfile.h>
 #include <unistd.h>
 #include <signal.h>
+#include <getopt.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <linux/futex.h>
+#include <sched.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "silence.h"
 
-typedef unsigned frameNumber_t;
-typedef unsigned frameCount_t;
+// Static probes for tracers, eg. bpftrace -l 'usdt:/usr/local/bin/silence:*'. Each is a nop
+// until a tracer attaches. Frames are analysis windows. The build defines HAVE_SDT if the
+// compiler has sys/sdt.h (systemtap-sdt-dev), otherwise the probes compile to nothing.
+//   batch(frame, level)                   every Detector::kprobeBatch frames
+//   silence_start(frame, level)
+//   silence_end(start, end, level)        level is the average over the silence
+//   cluster_state(start, end, from, to)   Cluster::state_t
+//   cut(start, end, state)                padded
+//   input_stall(offset), input_resume(offset, ready)  waiting on an empty pipe, ready 0 if it timed out
+#ifdef HAVE_SDT
+#include <sys/sdt.h>
+#define PROBE1(name, a) DTRACE_PROBE1(silence, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(silence, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(silence, name, a, b, c)
+#define PROBE4(name, a, b, c, d) DTRACE_PROBE4(silence, name, a, b, c, d)
+#else
+#define PROBE1(name, a) do {} while (0)
+#define PROBE2(name, a, b) do {} while (0)
+#define PROBE3(name, a, b, c) do {} while (0)
+#define PROBE4(name, a, b, c, d) do {} while (0)
+#endif
 
-// Output to python wrapper requires prefix to indicate level
-#define DELIMITER "@" // must correlate with python wrapper
 char prefixdebug[7] = "debug" DELIMITER;
 char prefixinfo[6]  = "info" DELIMITER;
 char prefixerr[5]   = "err" DELIMITER;
 char prefixcut[5]   = "cut" DELIMITER;
+char prefixreset[7] = "reset" DELIMITER; // earlier cuts are void & will be reported again
+char prefixthreshold[11] = "threshold" DELIMITER; // a report at a further threshold follows its number
 
-void error(const char* mesg, bool die = true)
+// I/O priority is not in glibc: values from linux/ioprio.h
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_IDLE  3
+#define IOPRIO_CLASS_SHIFT 13
+
+FILE* messages = stdout;
+
+void error(const char* mesg, bool die)
 {
-    printf("%s%s\n", prefixerr, mesg);
+    fprintf(messages, "%s%s\n", prefixerr, mesg);
     if (die)
         exit(1);
 }
 
 pid_t tail_pid = 0;
-void watchdog(int sig)
+
+// allocations made with new, reported by --stats. Counting costs less than testing the option
+unsigned long long allocations = 0;
+void* operator new(size_t size)
+{
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    void* p = malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+volatile sig_atomic_t snapshotRequested = 0;
+void requestSnapshot(int sig)
 {
-    if (0 != tail_pid)
-        kill(tail_pid, SIGTERM);
+    snapshotRequested = 1;
+}
+
+volatile sig_atomic_t controlRequested = 0;
+void requestControl(int sig)
+{
+    controlRequested = 1;
+}
+
+volatile sig_atomic_t dumpRequested = 0;
+void requestDump(int sig)
+{
+    dumpRequested = 1;
 }
 
 namespace Arg
 // Program argument management
 {
-const float kvideoRate = 25.0;  // sample rate in fps (maps time to frame count)
-const frameCount_t krateInMins = kvideoRate * 60; // frames per min
-unsigned useThreshold;          // Audio level of silence
-frameCount_t useMinQuiet;       // Minimum length of a silence to register
-unsigned useMinDetect;          // Minimum number of silences that constitute an advert
-frameCount_t useMinLength;      // adverts must be at least this long
-frameCount_t useMaxSep;         // silences must be closer than this to be in the same cluster
-frameCount_t usePad;            // padding for each cut
+// Detection works in analysis windows, which are one video frame unless set otherwise.
+// Reports are in video frames
+unsigned useFpsNum = 25;            // video frame rate (maps time to frame count) as a fraction
+unsigned useFpsDen = 1;
+unsigned useWindowNum = 1;          // analysis window in secs as a fraction
+unsigned useWindowDen = 25;
+float videoRate = 25.0;             // frames per sec
+float windowRate = 25.0;            // windows per sec
+// presets are per thread so that a worker can run jobs with different ones
+thread_local unsigned useThreshold;     // Audio level of silence
+thread_local unsigned useExitThreshold; // Audio level that ends a silence
+thread_local frameCount_t useMinQuiet;  // Minimum length of a silence to register
+thread_local unsigned useMinDetect;     // Minimum number of silences that constitute an advert
+thread_local frameCount_t useMinLength; // adverts must be at least this long
+thread_local frameCount_t useMaxSep;    // silences must be closer than this to be in the same cluster
+thread_local frameCount_t usePad;       // padding for each cut
+
+// action taken when no input has arrived for the idle period
+enum idleAction_t {idleKill, idleFinish, idleWait};
+int useIdleTimeout = 30000;         // idle period in ms
+idleAction_t useIdleAction = idleKill;
+const char* useExport = NULL;       // file to receive list of all silences
+const char* useLevels = NULL;       // file to receive the level of every frame
+const char* useRing = NULL;         // shared memory file to publish reports to as events
+const char* useLevelRing = NULL;    // shared memory file to publish the level of every frame to
+const char* useReadRing = NULL;     // shared memory file to print the records of
+const char* useRecorder = NULL;     // file to dump the flight recorder to at exit, as well as on demand
+unsigned useFloor = 0;              // export levels of frames quieter than this, 0 for just silences
+const char* useRecluster = NULL;    // exported file to detect from instead of audio
+const char* useReplay = NULL;       // file of silences to process before the input
+time_t useLiveStart = 0;            // time recording started, if it is live
+float useMaxLag = 20;               // secs behind the recording before degrading analysis
+float useCpuBudget = 0;             // share of a CPU that may be used, 0 for unlimited
+bool useBackground = false;         // only run when the system is otherwise idle
+bool useKeepCache = false;          // leave file data in the page cache after reading it
+bool useStats = false;              // report the resources used at the end
+const char* useFeed = NULL;         // file to copy to stdout instead of detecting
+off_t useFeedFrom = 0;              // byte to start feeding from
+off_t useFeedLength = 0;            // bytes to feed, 0 for all
+bool useFollow = false;             // keep feeding as the file grows
+int useAudioPid = -1;               // TS audio PID to feed, 0 for the first in the PMT, -1 for everything
+bool useElementary = false;         // feed the elementary stream of the audio PID, not its packets
+const char* useSnapshot = NULL;     // file to save detection state to on SIGUSR1
+const char* useControl = NULL;      // file to read new presets from on SIGHUP
+frameCount_t useSparse = 0;         // stride of a sparse scan of a file, 0 to scan every frame
+float useHysteresis = 0;            // dB above the threshold that ends a silence
+std::vector<unsigned> useThresholds; // further thresholds to detect at in the same pass
+float useAdaptive = 0;              // dB below the programme floor for the threshold, 0 for fixed
+float useAdaptQuantile = 0.05;      // share of frames quieter than the programme floor
+const char* useRestore = NULL;      // file to restore detection state from
+const char* useCoordinate = NULL;   // [address:]port to coordinate workers on
+const char* useWork = NULL;         // coordinator (host:port) to work for
+unsigned useSlots = 0;              // jobs worked on at once, 0 for one per CPU
+const char* useDecoder =            // shell command writing AU audio of recording $1 to stdout,
+    "f=; [ -n \"$(find \"$1\" -mmin -1)\" ] && f=--follow; "   // following it if it is still being written
+    "exec /usr/local/bin/silence --feed=\"$1\" $f --audio-pid=auto"
+    " | mythffmpeg -loglevel quiet -i pipe:0 -f au -ac 6 -";
+bool useStreams = false;            // detect several inputs at once
+char* const* useStreamFiles = NULL; // their audio files/pipes
+int useStreamCount = 0;
+
+frameNumber_t toFrame(frameNumber_t window)
+// First video frame of an analysis window
+{
+    if (1ULL * useWindowNum * useFpsNum == 1ULL * useWindowDen * useFpsDen)
+        return window;
+    return (window - 1ULL) * useWindowNum * useFpsNum / (1ULL * useWindowDen * useFpsDen) + 1;
+}
+
+frameNumber_t toLastFrame(frameNumber_t window)
+// Last video frame of an analysis window
+{
+    if (1ULL * useWindowNum * useFpsNum == 1ULL * useWindowDen * useFpsDen)
+        return window;
+    const unsigned long long den = 1ULL * useWindowDen * useFpsDen;
+    return (window * 1ULL * useWindowNum * useFpsNum + den - 1) / den;
+}
+
+sf_count_t windowStart(frameNumber_t window, int sampleRate)
+// First sample frame of an analysis window, numbered from 0.
+// Windows of a fractional number of samples alternate in size so that they never drift
+{
+    return window * 1LL * sampleRate * useWindowNum / useWindowDen;
+}
+
+frameCount_t toFrames(frameCount_t windows)
+// Video frames lasting as long as a number of analysis windows
+{
+    if (1ULL * useWindowNum * useFpsNum == 1ULL * useWindowDen * useFpsDen)
+        return windows;
+    return lrint(double(windows) * useWindowNum * useFpsNum / (double(useWindowDen) * useFpsDen));
+}
+
+size_t windowSamples(frameNumber_t window, int sampleRate)
+// Sample frames in an analysis window, numbered from 1
+{
+    return windowStart(window, sampleRate) - windowStart(window - 1, sampleRate);
+}
+
+size_t maxWindowSamples(int sampleRate)
+// Sample frames in the longest analysis window
+{
+    return windowSamples(1, sampleRate) + 1;
+}
 
 void usage()
 {
-    error("Usage: silence <tail_pid> <threshold> <minquiet> <mindetect> <minlength> <maxsep> <pad>", false);
+    error("Usage: silence [options] <tail_pid> <threshold> <minquiet> <mindetect> <minlength> <maxsep> <pad>", false);
+    error("--idle=<secs>      : (float)  time without input before the input is idle (default 30).", false);
+    error("--idle-action=<act>: kill - kill <tail_pid> (default), finish - end detection, wait - keep waiting.", false);
+    error("--export=<file>    : write all silences, however short, to file.", false);
+    error("--floor=<dB>       : (float)  export levels of all frames below this instead, for reclustering.", false);
+    error("--levels=<file>    : write the level of every frame to file, for silence-calibrate.", false);
+    error("--ring=<file>      : also publish reports as fixed-size events in a shared memory ring,", false);
+    error("                     ie. /dev/shm/silence. A restored detection continues the ring.", false);
+    error("--level-ring=<file>: publish the level of every frame, and of each channel when every sample", false);
+    error("                     is analysed, in a shared memory ring of the last 45000 frames.", false);
+    error("--recorder=<file>  : the last 30 mins of levels & reports are dumped to file on SIGUSR2, when an", false);
+    error("                     advert cut is suspiciously short & at exit.", false);
+    error("--replay=<file>    : process silences exported from the start of the recording, then the input.", false);
+    error("--live-start=<time>: (int)    time (secs since epoch) that a live recording started.", false);
+    error("--max-lag=<secs>   : (float)  lag behind a live recording that degrades analysis (default 20).", false);
+    error("--cpu-budget=<share>: (float) maximum share of a CPU to use, ie. 0.25 (default unlimited).", false);
+    error("--background       : use idle CPU scheduling and I/O priority, for backlog jobs.", false);
+    error("--keep-cache       : leave file data in the page cache after reading it.", false);
+    error("--stats            : report the allocations made, at the end.", false);
+    error("--snapshot=<file>  : on SIGUSR1 save detection state to file and exit.", false);
+    error("--restore=<file>   : continue from a snapshot. Input must start at the frame after it.", false);
+    error("--sparse=<secs>    : (float)  for a finished file, only analyse around quiet frames found every", false);
+    error("                     <secs>. Shorter silences may be missed.", false);
+    error("--fps=<num>[/<den>]: video frame rate that cut points are reported in, ie. 30000/1001 (default 25).", false);
+    error("--window=<ms>      : (int)    analysis window (default one video frame). Presets are rounded to it.", false);
+    error("--hysteresis=<dB>  : (float)  silences end once the level is this far above the threshold.", false);
+    error("--thresholds=<dB>[,<dB>...]: also detect at these thresholds in the same pass. Their reports", false);
+    error("                     are prefixed by threshold@ & their number, from 2. Excludes export,", false);
+    error("                     replay, restore, snapshot, sparse & adaptive.", false);
+    error("--adaptive=<dB>    : (float)  raise the threshold to <dB> below the programme floor, as it is", false);
+    error("                     estimated from the levels read so far. Excludes export, replay, restore,", false);
+    error("                     snapshot & sparse.", false);
+    error("--adapt-quantile=<share>: (float) share of frames below the programme floor (default 0.05).", false);
+    error("--control=<file>   : on SIGHUP read six presets from file, optionally followed by 'recluster'", false);
+    error("                     to re-evaluate the silences so far, and write the state to <file>.reply.", false);
+    error("Or: silence [options] --recluster=<file> <threshold> <minquiet> <mindetect> <minlength> <maxsep> <pad>", false);
+    error("Detects from an exported file or a levels file instead of audio. The threshold can't exceed", false);
+    error("the floor of an export.", false);
+    error("Or: silence [options] --streams <threshold> <minquiet> <mindetect> <minlength> <maxsep> <pad> <audio>...", false);
+    error("Detects several AU files/pipes at once. Reports are prefixed by the stream number. A stream", false);
+    error("carrying the same audio as another is still read, but takes its levels from the other rather", false);
+    error("than analysing them. Pipes are read as data arrives, so a stalled stream doesn't hold up the rest.", false);
+    error("Or: silence [options] --coordinator=[<address>:]<port>", false);
+    error("Queues jobs from clients & distributes them to workers. Listens on loopback unless given an", false);
+    error("address. There is no authentication: any host that can connect can have workers read any file", false);
+    error("they can & run the decoder on it, so only listen on a trusted network.", false);
+    error("Or: silence [options] --worker=<host:port> [--slots=<jobs>] [--decoder=<command>]", false);
+    error("Runs jobs from a coordinator. The decoder writes AU audio of recording $1 to stdout. The default", false);
+    error("follows a recording that was written to in the last minute, as it is still being recorded.", false);
+    error("Or: silence --read-ring=<file>", false);
+    error("Prints the records of an event or level ring as they are published, until its writer finishes.", false);
+    error("Or: silence [options] --feed=<file> [--from=<byte>] [--length=<bytes>] [--follow]", false);
+    error("Copies file to stdout, dropping it from the page cache, for decoding. With --follow it", false);
+    error("continues as the file grows until it is idle.", false);
+    error("--audio-pid=<pid>|auto: of an MPEG-TS, only copy the packets of this audio PID (or the first", false);
+    error("                     in the PMT), the PAT & PMT. Files that aren't TS are copied whole.", false);
+    error("--elementary       : copy the elementary stream of the audio PID instead. Its format is reported.", false);
     error("<tail_pid> : (int)    Process ID to be killed after idle timeout.", false);
     error("<threshold>: (float)  silence threshold in dB.", false);
     error("<minquiet> : (float)  minimum time for silence detection in seconds.", false);
@@ -67,53 +313,340 @@ void usage()
     error("Example: silence 4567 -75 0.1 5 60 90 1 < audio.au");
 }
 
+unsigned exitThreshold(unsigned threshold)
+// Level that ends a silence started below a threshold
+{
+    return std::min<double>(INT_MAX, rint(threshold * pow(10, useHysteresis / 20)));
+}
+
+const char* presets(char* const* values, float* args)
+{
+    static const char* name[6] = {"threshold", "minquiet", "mindetect", "minlength", "maxsep", "pad"};
+    for (int i = 0; i < 6; i++)
+        if (1 != sscanf(values[i], "%f", &args[i]))
+            return name[i];
+
+    /* Scale threshold to integer range that libsndfile will use. */
+    useThreshold = rint(INT_MAX * pow(10, args[0] / 20));
+    useExitThreshold = exitThreshold(useThreshold);
+
+    /* Scale times to analysis windows. */
+    useMinQuiet  = ceil(args[1] * windowRate);
+    useMinDetect = (int)args[2];
+    useMinLength = ceil(args[3] * windowRate);
+    useMaxSep    = rint(args[4] * windowRate + 0.5);
+    usePad       = rint(args[5] * windowRate + 0.5);
+    return NULL;
+}
+
 void parse(int argc, char **argv)
 // Parse args and convert to useable values (frames)
 {
-    if (8 != argc)
-        usage();
+    static const option longopts[] = {
+        {"idle",        required_argument, NULL, 'i'},
+        {"idle-action", required_argument, NULL, 'a'},
+        {"export",      required_argument, NULL, 'e'},
+        {"levels",      required_argument, NULL, 'V'},
+        {"ring",        required_argument, NULL, 'G'},
+        {"level-ring",  required_argument, NULL, 'K'},
+        {"read-ring",   required_argument, NULL, 'J'},
+        {"recorder",    required_argument, NULL, 'Y'},
+        {"replay",      required_argument, NULL, 'r'},
+        {"live-start",  required_argument, NULL, 'l'},
+        {"max-lag",     required_argument, NULL, 'm'},
+        {"cpu-budget",  required_argument, NULL, 'c'},
+        {"background",  no_argument,       NULL, 'b'},
+        {"keep-cache",  no_argument,       NULL, 'k'},
+        {"stats",       no_argument,       NULL, 'N'},
+        {"feed",        required_argument, NULL, 'f'},
+        {"from",        required_argument, NULL, 'F'},
+        {"length",      required_argument, NULL, 'L'},
+        {"follow",      no_argument,       NULL, 'w'},
+        {"audio-pid",   required_argument, NULL, 'P'},
+        {"elementary",  no_argument,       NULL, 'E'},
+        {"snapshot",    required_argument, NULL, 's'},
+        {"restore",     required_argument, NULL, 'R'},
+        {"coordinator", required_argument, NULL, 'C'},
+        {"worker",      required_argument, NULL, 'W'},
+        {"slots",       required_argument, NULL, 'S'},
+        {"decoder",     required_argument, NULL, 'D'},
+        {"streams",     no_argument,       NULL, 'M'},
+        {"floor",       required_argument, NULL, 'o'},
+        {"recluster",   required_argument, NULL, 'u'},
+        {"control",     required_argument, NULL, 'H'},
+        {"sparse",      required_argument, NULL, 'p'},
+        {"fps",         required_argument, NULL, 'v'},
+        {"window",      required_argument, NULL, 'z'},
+        {"hysteresis",  required_argument, NULL, 'y'},
+        {"thresholds",  required_argument, NULL, 'T'},
+        {"adaptive",    required_argument, NULL, 'A'},
+        {"adapt-quantile", required_argument, NULL, 'Q'},
+        {NULL, 0, NULL, 0}
+    };
+    float argIdle = useIdleTimeout / 1000.0; // secs
+    float argFloor = 0; // dB
+    float argSparse = 0; // secs
+    unsigned argWindow = 0; // ms
+
+    // options precede the positional args. Stop at the first of those as thresholds are negative.
+    // --streams & --recluster are followed directly by them
+    int opt;
+    while (!useStreams && !useRecluster && -1 != (opt = getopt_long(argc, argv, "+", longopts, NULL)))
+    {
+        switch (opt)
+        {
+        case 'i':
+            if (1 != sscanf(optarg, "%f", &argIdle) || argIdle <= 0)
+                error("Could not parse idle option into a positive number");
+            break;
+        case 'a':
+            if (0 == strcmp(optarg, "kill"))
+                useIdleAction = idleKill;
+            else if (0 == strcmp(optarg, "finish"))
+                useIdleAction = idleFinish;
+            else if (0 == strcmp(optarg, "wait"))
+                useIdleAction = idleWait;
+            else
+                error("Idle action must be one of kill, finish or wait");
+            break;
+        case 'e':
+            useExport = optarg;
+            break;
+        case 'V':
+            useLevels = optarg;
+            break;
+        case 'G':
+            useRing = optarg;
+            break;
+        case 'K':
+            useLevelRing = optarg;
+            break;
+        case 'J':
+            useReadRing = optarg;
+            break;
+        case 'Y':
+            useRecorder = optarg;
+            break;
+        case 'r':
+            useReplay = optarg;
+            break;
+        case 'l':
+            if (1 != sscanf(optarg, "%ld", &useLiveStart))
+                error("Could not parse live-start option into a number");
+            break;
+        case 'm':
+            if (1 != sscanf(optarg, "%f", &useMaxLag) || useMaxLag <= 0)
+                error("Could not parse max-lag option into a positive number");
+            break;
+        case 'c':
+            if (1 != sscanf(optarg, "%f", &useCpuBudget) || useCpuBudget <= 0 || useCpuBudget > 1)
+                error("CPU budget must be a number between 0 and 1");
+            break;
+        case 'b':
+            useBackground = true;
+            break;
+        case 'k':
+            useKeepCache = true;
+            break;
+        case 'N':
+            useStats = true;
+            break;
+        case 'f':
+            useFeed = optarg;
+            // stdout carries the file
+            messages = stderr;
+            break;
+        case 'F':
+            if (1 != sscanf(optarg, "%ld", &useFeedFrom) || useFeedFrom < 0)
+                error("Could not parse from option into a byte offset");
+            break;
+        case 'L':
+            if (1 != sscanf(optarg, "%ld", &useFeedLength) || useFeedLength < 0)
+                error("Could not parse length option into a number of bytes");
+            break;
+        case 'w':
+            useFollow = true;
+            break;
+        case 'P':
+            if (0 == strcmp(optarg, "auto"))
+                useAudioPid = 0;
+            else if (1 != sscanf(optarg, "%i", &useAudioPid) || useAudioPid <= 0 || useAudioPid > 0x1fff)
+                error("Could not parse audio PID option into a PID");
+            break;
+        case 'E':
+            useElementary = true;
+            break;
+        case 's':
+            useSnapshot = optarg;
+            break;
+        case 'R':
+            useRestore = optarg;
+            break;
+        case 'C':
+            useCoordinate = optarg;
+            break;
+        case 'W':
+            useWork = optarg;
+            break;
+        case 'S':
+            if (1 != sscanf(optarg, "%u", &useSlots) || 0 == useSlots)
+                error("Could not parse slots option into a positive number");
+            break;
+        case 'D':
+            useDecoder = optarg;
+            break;
+        case 'M':
+            useStreams = true;
+            break;
+        case 'o':
+            if (1 != sscanf(optarg, "%f", &argFloor) || argFloor >= 0)
+                error("Could not parse floor option into a negative number");
+            useFloor = rint(INT_MAX * pow(10, argFloor / 20));
+            break;
+        case 'u':
+            useRecluster = optarg;
+            break;
+        case 'H':
+            useControl = optarg;
+            break;
+        case 'p':
+            if (1 != sscanf(optarg, "%f", &argSparse) || argSparse <= 0)
+                error("Could not parse sparse option into a positive number");
+            break;
+        case 'v':
+            useFpsDen = 1;
+            if (sscanf(optarg, "%u/%u", &useFpsNum, &useFpsDen) < 1 || 0 == useFpsNum || 0 == useFpsDen)
+                error("Could not parse fps option into a rate or fraction");
+            break;
+        case 'z':
+            if (1 != sscanf(optarg, "%u", &argWindow) || 0 == argWindow)
+                error("Could not parse window option into a positive number of ms");
+            break;
+        case 'y':
+            if (1 != sscanf(optarg, "%f", &useHysteresis) || useHysteresis < 0)
+                error("Could not parse hysteresis option into a number of dB");
+            break;
+        case 'T':
+            for (char* value = strtok(optarg, ","); value; value = strtok(NULL, ","))
+            {
+                float dB;
+                if (1 != sscanf(value, "%f", &dB) || dB >= 0)
+                    error("Could not parse thresholds option into negative numbers of dB");
+                useThresholds.push_back(std::max(1.0, rint(INT_MAX * pow(10, dB / 20))));
+            }
+            break;
+        case 'A':
+            if (1 != sscanf(optarg, "%f", &useAdaptive) || useAdaptive <= 0)
+                error("Could not parse adaptive option into a positive number of dB");
+            break;
+        case 'Q':
+            if (1 != sscanf(optarg, "%f", &useAdaptQuantile) || useAdaptQuantile <= 0 || useAdaptQuantile >= 1)
+                error("Could not parse adapt-quantile option into a share between 0 and 1");
+            break;
+        default:
+            usage();
+        }
+    }
+    useIdleTimeout = rint(argIdle * 1000);
+    // window is a video frame unless set
+    useWindowNum = (argWindow ? argWindow : useFpsDen);
+    useWindowDen = (argWindow ? 1000 : useFpsNum);
+    videoRate = float(useFpsNum) / useFpsDen;
+    windowRate = float(useWindowDen) / useWindowNum;
+    useSparse = ceil(argSparse * windowRate);
+    if (useReplay && useRestore)
+        error("Can only resume from one of replay or restore");
+    if (useFloor && !useExport)
+        error("Floor only applies to an export");
+    if (useLevels && (useReplay || useRestore || useRecluster || useSparse || useStreams))
+        error("Levels can only be written when every frame of the input is analysed");
+    if (useLevelRing && (useSparse || useStreams || useRecluster))
+        error("Levels can only be published when every frame of the input is analysed");
+    if (!useThresholds.empty() && (useExport || useReplay || useRestore || useSnapshot || useSparse || useAdaptive))
+        error("Further thresholds can't be combined with export, replay, restore, snapshot, sparse or adaptive");
+    // exports, replays, snapshots & sparse scans assume one threshold throughout
+    if (useAdaptive && (useExport || useReplay || useRestore || useSnapshot || useRecluster || useSparse))
+        error("Adaptive threshold can't be combined with export, replay, restore, snapshot, recluster or sparse");
+
+    if (useElementary && useAudioPid < 0)
+        error("Elementary stream needs an audio PID");
+    if (useAudioPid >= 0 && !useFeed)
+        error("Audio PID only applies to feeding");
+
+    // feeding & distribution need no detection parameters
+    if (useFeed || useCoordinate || useWork || useReadRing)
+        return;
 
-    float argThreshold; // db
-    float argMinQuiet; // secs
-    float argMinDetect;
-    float argMinLength; // secs
-    float argMaxSep; // secs
-    float argPad; // secs
+    // Remove logging prefixes if writing to terminal
+    if (isatty(1))
+        prefixcut[0] = prefixinfo[0] = prefixdebug[0] = prefixerr[0] = prefixreset[0] = prefixthreshold[0] = '\0';
+
+    // shift positional args so that argv[1] is the first of them
+    argc -= optind - 1;
+    argv += optind - 1;
+    char* const* values = argv + 2;
+    if (useRecluster)
+    {
+        // no tail_pid or input
+        if (7 != argc)
+            usage();
+        values = argv + 1;
+    }
+    else if (useStreams)
+    {
+        // no tail_pid: at least two audio inputs follow the presets
+        if (argc < 9)
+            usage();
+        values = argv + 1;
+        useStreamFiles = argv + 7;
+        useStreamCount = argc - 7;
+    }
+    else if (8 != argc)
+        usage();
 
     /* Load options. */
-    if (1 != sscanf(argv[1], "%d", &tail_pid))
+    if (!useStreams && !useRecluster && 1 != sscanf(argv[1], "%d", &tail_pid))
         error("Could not parse tail_pid option into a number");
-    if (1 != sscanf(argv[2], "%f", &argThreshold))
-        error("Could not parse threshold option into a number");
-    if (1 != sscanf(argv[3], "%f", &argMinQuiet))
-        error("Could not parse minquiet option into a number");
-    if (1 != sscanf(argv[4], "%f", &argMinDetect))
-        error("Could not parse mindetect option into a number");
-    if (1 != sscanf(argv[5], "%f", &argMinLength))
-        error("Could not parse minlength option into a number");
-    if (1 != sscanf(argv[6], "%f", &argMaxSep))
-        error("Could not parse maxsep option into a number");
-    if (1 != sscanf(argv[7], "%f", &argPad))
-        error("Could not parse pad option into a number");
 
-    /* Scale threshold to integer range that libsndfile will use. */
-    useThreshold = rint(INT_MAX * pow(10, argThreshold / 20));
-
-    /* Scale times to frames. */
-    useMinQuiet  = ceil(argMinQuiet * kvideoRate);
-    useMinDetect = (int)argMinDetect;
-    useMinLength = ceil(argMinLength * kvideoRate);
-    useMaxSep    = rint(argMaxSep * kvideoRate + 0.5);
-    usePad       = rint(argPad * kvideoRate + 0.5);
+    float arg[6]; // threshold (db), minquiet (secs), mindetect, minlength (secs), maxsep (secs), pad (secs)
+    if (const char* invalid = presets(values, arg))
+    {
+        char mesg[60];
+        snprintf(mesg, sizeof mesg, "Could not parse %s option into a number", invalid);
+        error(mesg);
+    }
+    if (useFloor && useFloor < useExitThreshold)
+        error("Floor must be at least the threshold, plus any hysteresis");
 
     printf("%sThreshold=%.1f, MinQuiet=%.2f, MinDetect=%.1f, MinLength=%.1f, MaxSep=%.1f, Pad=%.2f\n",
-           prefixdebug, argThreshold, argMinQuiet, argMinDetect, argMinLength, argMaxSep, argPad);
+           prefixdebug, arg[0], arg[1], arg[2], arg[3], arg[4], arg[5]);
+    if (windowRate != videoRate)
+        printf("%sAnalysing in %.1f ms windows: preset lengths below are in windows, not frames\n",
+               prefixdebug, 1000.0 / windowRate);
     printf("%sFrame rate is %.2f, Detecting silences below %d that last for at least %d frames\n",
-           prefixdebug, kvideoRate, useThreshold, useMinQuiet);
+           prefixdebug, videoRate, useThreshold, useMinQuiet);
     printf("%sClusters are composed of a minimum of %d silences closer than %d frames and must be\n",
            prefixdebug, useMinDetect, useMaxSep);
     printf("%slonger than %d frames in total. Cuts will be padded by %d frames\n",
            prefixdebug, useMinLength, usePad);
+    if (useFloor)
+        printf("%sExporting levels of frames below %d\n", prefixdebug, useFloor);
+    if (useSparse > useMinQuiet)
+        printf("%sSparse scan may miss silences shorter than %d frames\n", prefixinfo, useSparse);
+    else if (useSparse)
+        printf("%sSparse scan will find every silence\n", prefixdebug);
+    if (useHysteresis)
+        printf("%sSilences end above %d, %.1f dB above the threshold\n", prefixdebug, useExitThreshold, useHysteresis);
+    for (size_t i = 0; i < useThresholds.size(); i++)
+        printf("%sAlso detecting silences below %d, reported as threshold %lu\n", prefixdebug, useThresholds[i], i + 2);
+    if (useAdaptive)
+        printf("%sThreshold rises to %.1f dB below the level of the quietest %.0f%% of frames\n",
+               prefixdebug, useAdaptive, useAdaptQuantile * 100);
+    printf("%sInput is idle after %.1f secs without data\n", prefixdebug, argIdle);
+    if (useLiveStart)
+        printf("%sRecording is live, analysis will degrade when %.0f secs behind it\n", prefixdebug, useMaxLag);
+    if (useCpuBudget)
+        printf("%sLimited to %.0f%% of a CPU\n", prefixdebug, useCpuBudget * 100);
     printf("%s< preroll, > postroll, - advert, ? too few silences, # too short, = comm flagged\n", prefixdebug);
     printf("%s           Start - End    Start - End      Duration         Interval    Level/Count\n", prefixinfo);
     printf("%s          frame - frame (mmm:ss-mmm:ss) frame (mm:ss.s)  frame (mmm:ss)\n", prefixinfo);
@@ -155,6 +688,7 @@ class Cluster
 private:
     void setState()
     {
+        const state_t was = state;
         if (this->start->start == 1)
             state = preroll;
         else if (this->end->state == Silence::progEnd)
@@ -165,6 +699,8 @@ private:
             state = toofew;
         else
             state = advert;
+        if (state != was)
+            PROBE4(cluster__state, start->start, end->end, int(was), int(state));
     }
 
 public:
@@ -172,8 +708,6 @@ public:
     enum state_t {tooshort, toofew, unset, preroll, advert, postroll};
     static const char state_log[6];
 
-    static frameNumber_t completesAt; // frame where the most recent cluster will complete
-
     state_t state;          // type of cluster
     const Silence* start;   // first silence
     Silence* end;           // last silence
@@ -181,6 +715,7 @@ public:
     unsigned silenceCount;  // number of silences
     frameCount_t length;    // number of frames
     frameCount_t interval;  // frames between end of last cluster and start of this one
+    frameNumber_t completesAt; // frame where the cluster will complete
 
     Cluster(Silence* s) : state(unset), start(s), end(s), silenceCount(1), length(s->length), interval(0)
     {
@@ -204,7 +739,6 @@ public:
 };
 // c++0x doesn't allow initialisation within class
 const char Cluster::state_log[6] = {'#', '?', '.', '<', '-', '>'};
-frameNumber_t Cluster::completesAt = 0;
 
 class ClusterList
 // Manages a list of detected silences and a list of assigned clusters
@@ -217,6 +751,29 @@ protected:
     std::deque<Cluster*> cluster;
 
 public:
+    frameNumber_t lastSilenceEnd; // end of most recent silence, 0 if none
+    frameNumber_t lastClusterEnd; // end of most recent cluster, 0 if none
+
+    ClusterList() : lastSilenceEnd(0), lastClusterEnd(0) {}
+
+    ~ClusterList()
+    {
+        for (std::deque<Cluster*>::iterator c = cluster.begin(); c != cluster.end(); ++c)
+            delete *c;
+        for (std::deque<Silence*>::iterator s = silence.begin(); s != silence.end(); ++s)
+            delete *s;
+    }
+
+    const std::deque<Silence*>& silences() const
+    {
+        return silence;
+    }
+
+    size_t clusters() const
+    {
+        return cluster.size();
+    }
+
     Silence* insertStartSilence()
     // Inserts a fake silence at the front of the silence list
     {
@@ -231,9 +788,16 @@ public:
     {
         // set interval between this & previous silence/prog start
         newSilence->interval = newSilence->start
-                - (silence.empty() ? 1 : silence.back()->end - 1);
+                - (lastSilenceEnd ? lastSilenceEnd - 1 : 1);
         // store silence
         silence.push_back(newSilence);
+        lastSilenceEnd = newSilence->end;
+    }
+
+    void adopt(Silence* restored)
+    // Takes ownership of a silence restored from a snapshot
+    {
+        silence.push_back(restored);
     }
 
     void addCluster(Cluster* newCluster)
@@ -241,148 +805,369 @@ public:
     {
         // set interval between new cluster & previous one/prog start
         newCluster->interval = newCluster->start->start
-                - (cluster.empty() ? 1 : cluster.back()->end->end - 1);
+                - (lastClusterEnd ? lastClusterEnd - 1 : 1);
         // store cluster
         cluster.push_back(newCluster);
+        lastClusterEnd = newCluster->end->end;
     }
 };
 
-Silence* currentSilence; // the silence currently being detected/built
-Cluster* currentCluster; // the cluster currently being built
-ClusterList* clist;      // List of completed silences & clusters
-
-void report(const char* err,
+void report(Output& output,
+            const char* err,
             const char type,
             const char* msg1,
-            const frameNumber_t start,
-            const frameNumber_t end,
-            const frameNumber_t interval,
+            frameNumber_t start,
+            frameNumber_t end,
+            frameNumber_t interval,
             const int power)
-// Logs silences/clusters/cuts in a standard format
+// Logs silences/clusters/cuts, given in analysis windows, in a standard format of video frames
 {
+    start = Arg::toFrame(start);
+    // padding can take the end of a cut at the start of a recording below frame 0
+    end = int(end) < 0 ? -Arg::toFrames(-int(end)) : Arg::toLastFrame(end);
+    interval = Arg::toFrames(interval);
     frameCount_t duration = end - start + 1;
+    const float rateInMins = Arg::videoRate * 60; // frames per min
 
-    printf("%s%c %7s %6d-%6d (%3d:%02ld-%3d:%02ld), %4d (%2d:%04.1f), %5d (%3d:%02ld), [%7d]\n",
-           err, type, msg1, start, end,
-           (start+13) / Arg::krateInMins, lrint(start / Arg::kvideoRate) % 60,
-           (end+13) / Arg::krateInMins, lrint(end / Arg::kvideoRate) % 60,
-           duration, (duration+1) / Arg::krateInMins, fmod(duration / Arg::kvideoRate, 60),
-           interval, (interval+13) / Arg::krateInMins, lrint(interval / Arg::kvideoRate) % 60, power);
+    char text[100];
+    snprintf(text, sizeof text, "%c %7s %6d-%6d (%3d:%02ld-%3d:%02ld), %4d (%2d:%04.1f), %5d (%3d:%02ld), [%7d]",
+           type, msg1, start, end,
+           int((start+13) / rateInMins), lrint(start / Arg::videoRate) % 60,
+           int((end+13) / rateInMins), lrint(end / Arg::videoRate) % 60,
+           duration, int((duration+1) / rateInMins), fmod(duration / Arg::videoRate, 60),
+           interval, int((interval+13) / rateInMins), lrint(interval / Arg::videoRate) % 60, power);
+    output.write(err, text);
+    output.event(err == prefixcut ? eventCut : 'S' == msg1[0] ? eventSilence : eventCluster,
+                 type, start, end, interval, power);
 }
 
-void processSilence()
-// Process a silence detection
+class LevelHistogram
+// Streaming estimate of level quantiles: counts levels in 0.5 dB buckets,
+// so adding a level is O(1) and memory is fixed however long the recording
 {
-    // ignore detections that are too short
-    if (currentSilence->state == Silence::detection && currentSilence->length < Arg::useMinQuiet)
+public:
+    LevelHistogram() : counts(kbuckets, 0), total(0) {}
+
+    void add(unsigned long long level)
     {
-        // throw it away
-        delete currentSilence;
-        currentSilence = NULL;
+        counts[bucket(level)]++;
+        total++;
     }
-    else
+
+    frameCount_t size() const
     {
-        // record new silence
-        clist->addSilence(currentSilence);
+        return total;
+    }
 
-        // assign it to a cluster
-        if (currentCluster)
+    unsigned long long quantile(float share) const
+    // Level that <share> of those added are below, to the bucket
+    {
+        const frameCount_t wanted = ceil(share * total);
+        frameCount_t below = 0;
+        for (unsigned b = 0; b < kbuckets; b++)
+            if ((below += counts[b]) >= wanted && below)
+                return upper(b);
+        return upper(kbuckets - 1);
+    }
+
+private:
+    static const unsigned kbuckets = 400; // 0.5 dB each, spanning levels 1 to beyond INT_MAX
+
+    std::vector<frameCount_t> counts;
+    frameCount_t total;
+
+    static unsigned bucket(unsigned long long level)
+    {
+        return level ? std::min<unsigned>(kbuckets - 1, 40 * log10(double(level))) : 0;
+    }
+
+    static unsigned long long upper(unsigned b)
+    // Level above every one in a bucket
+    {
+        return ceil(pow(10, (b + 1) / 40.0));
+    }
+};
+const unsigned LevelHistogram::kbuckets;
+
+class Detector
+// Detects silences in a stream of frame levels and allocates them to clusters
+{
+private:
+    Silence* currentSilence; // the silence currently being detected/built
+    Cluster* currentCluster; // the cluster currently being built
+    ClusterList* clist;      // List of completed silences & clusters
+    Output& output;          // receives reports
+
+    // Snapshot file layout: header, then the silence & cluster in progress if flagged.
+    // Native byte order: the version detects a mismatch
+    static const unsigned ksnapshotVersion = 3;
+    struct SilenceState
+    {
+        frameNumber_t start, end;
+        frameCount_t length, interval;
+        double power;
+        int state;
+    };
+    struct ClusterState
+    {
+        SilenceState start, end;
+        frameNumber_t padStart, padEnd, completesAt;
+        frameCount_t length, interval;
+        unsigned silenceCount;
+        int state;
+    };
+    struct SnapshotHeader
+    {
+        char magic[4];
+        unsigned version;
+        unsigned threshold, exitThreshold, minDetect; // parameters in use
+        frameCount_t minQuiet, minLength, maxSep, pad;
+        unsigned windowNum, windowDen;      // analysis window in secs, which frames count
+        frameNumber_t frames;               // frames processed
+        long long position;                 // bytes of input consumed
+        frameNumber_t lastSilenceEnd, lastClusterEnd;
+        bool silence, cluster;              // in progress
+    };
+
+    static void save(SilenceState& state, const Silence* s)
+    {
+        state.start = s->start;
+        state.end = s->end;
+        state.length = s->length;
+        state.interval = s->interval;
+        state.power = s->power;
+        state.state = s->state;
+    }
+
+    static Silence* load(const SilenceState& state)
+    {
+        Silence* s = new Silence(state.start, state.power, static_cast<Silence::state_t>(state.state));
+        s->end = state.end;
+        s->length = state.length;
+        s->interval = state.interval;
+        return s;
+    }
+
+    void processSilence()
+    // Process a silence detection
+    {
+        PROBE3(silence__end, currentSilence->start, currentSilence->end, lrint(currentSilence->power));
+
+        // export all real detections, as short ones may be completed by another scan
+        if (exportList && !exportFloor && currentSilence->state == Silence::detection)
+            fprintf(exportList, "%d %d %.1f\n", currentSilence->start, currentSilence->end, currentSilence->power);
+
+        // ignore detections that are too short
+        if (currentSilence->state == Silence::detection && currentSilence->length < Arg::useMinQuiet)
         {
-            // add to existing cluster
-            currentCluster->extend(currentSilence);
+            // throw it away
+            delete currentSilence;
+            currentSilence = NULL;
         }
-        else if (currentSilence->interval <= Arg::useMaxSep) // only possible for very first silence
+        else
         {
-            // First silence is close to prog start so extend cluster to the start
-            // by inserting a fake silence at prog start and starting the cluster there
-            currentCluster = new Cluster(clist->insertStartSilence());
-            currentCluster->extend(currentSilence);
+            // record new silence
+            clist->addSilence(currentSilence);
+
+            // assign it to a cluster
+            if (currentCluster)
+            {
+                // add to existing cluster
+                currentCluster->extend(currentSilence);
+            }
+            else if (currentSilence->interval <= Arg::useMaxSep) // only possible for very first silence
+            {
+                // First silence is close to prog start so extend cluster to the start
+                // by inserting a fake silence at prog start and starting the cluster there
+                currentCluster = new Cluster(clist->insertStartSilence());
+                currentCluster->extend(currentSilence);
+            }
+            else
+            {
+                // this silence is the start of a new cluster
+                currentCluster = new Cluster(currentSilence);
+            }
+            report(output, prefixdebug, currentSilence->state_log[currentSilence->state], "Silence",
+                   currentSilence->start, currentSilence->end,
+                   currentSilence->interval, currentSilence->power);
+
+            // silence is now owned by the list, start looking for next
+            currentSilence = NULL;
         }
-        else
+    }
+
+    void exportCandidate()
+    // Export a run of frames below the floor with their levels
+    {
+        unsigned long long total = 0;
+        for (size_t i = 0; i < candidate.size(); i++)
+            total += candidate[i];
+        fprintf(exportList, "%d %d %.1f", candidateStart, candidateStart + frameCount_t(candidate.size()) - 1,
+                double(total) / candidate.size());
+        for (size_t i = 0; i < candidate.size(); i++)
+            fprintf(exportList, " %llu", candidate[i]);
+        fputc('\n', exportList);
+        candidate.clear();
+    }
+
+    static unsigned long long below(const unsigned* levels, unsigned count, unsigned threshold)
+    // Bitmask of which of up to 64 levels are below a threshold
+    {
+        unsigned long long mask = 0;
+        unsigned i = 0;
+#ifdef __SSE2__
+        // levels & thresholds never exceed INT_MAX, so compare as signed
+        const __m128i limit = _mm_set1_epi32(threshold);
+        for (; i + 4 <= count; i += 4)
         {
-            // this silence is the start of a new cluster
-            currentCluster = new Cluster(currentSilence);
+            const __m128i quieter = _mm_cmplt_epi32(_mm_loadu_si128((const __m128i*)(levels + i)), limit);
+            mask |= (unsigned long long)_mm_movemask_ps(_mm_castsi128_ps(quieter)) << i;
         }
-        report(prefixdebug, currentSilence->state_log[currentSilence->state], "Silence",
-               currentSilence->start, currentSilence->end,
-               currentSilence->interval, currentSilence->power);
+#endif
+        for (; i < count; i++)
+            mask |= (unsigned long long)(levels[i] < threshold) << i;
+        return mask;
+    }
 
-        // silence is now owned by the list, start looking for next
-        currentSilence = NULL;
+    static frameCount_t next(const std::vector<unsigned long long>& masks, frameCount_t from, bool set)
+    // First frame (from 0) at or after another whose bit is set/clear
+    {
+        for (size_t w = from / 64; w < masks.size(); w++)
+        {
+            unsigned long long bits = set ? masks[w] : ~masks[w];
+            if (w == from / 64)
+                bits &= ~0ULL << (from % 64);
+            if (bits)
+                return w * 64 + __builtin_ctzll(bits);
+        }
+        return masks.size() * 64;
     }
-}
 
-void processCluster()
-// Process a completed cluster
-{
-    // record new cluster
-    clist->addCluster(currentCluster);
+    void replayed(Silence* next, frameNumber_t& lastEnd)
+    // Process a silence from a replay file, as if the frames before it had been read
+    {
+        // previous silence ended at the frame after it
+        if (currentSilence)
+            processSilence();
+        // the noise since then may have completed the cluster
+        if (currentCluster && next->start - 1 > currentCluster->completesAt && next->start - 1 >= lastEnd + 2)
+            processCluster();
 
-    report(prefixinfo, currentCluster->state_log[currentCluster->state], "Cluster",
-           currentCluster->start->start, currentCluster->end->end,
-           currentCluster->interval, currentCluster->silenceCount);
+        currentSilence = next;
+        lastEnd = next->end;
+    }
 
-    // only flag clusters at final state
-    if (currentCluster->state > Cluster::unset)
-        report(prefixcut, '=', "Cut", currentCluster->padStart, currentCluster->padEnd, 0, 0);
+    void processCluster()
+    // Process a completed cluster
+    {
+        // record new cluster
+        clist->addCluster(currentCluster);
 
-    // cluster is now owned by the list, start looking for next
-    currentCluster = NULL;
-}
+        report(output, prefixinfo, currentCluster->state_log[currentCluster->state], "Cluster",
+               currentCluster->start->start, currentCluster->end->end,
+               currentCluster->interval, currentCluster->silenceCount);
 
-int main(int argc, char **argv)
-// Detect silences and allocate to clusters
-{
-    // Remove logging prefixes if writing to terminal
-    if (isatty(1))
-        prefixcut[0] = prefixinfo[0] = prefixdebug[0] = prefixerr[0] = '\0';
+        // only flag clusters at final state
+        if (currentCluster->state > Cluster::unset)
+        {
+            PROBE3(cut, currentCluster->padStart, currentCluster->padEnd, int(currentCluster->state));
+            report(output, prefixcut, '=', "Cut", currentCluster->padStart, currentCluster->padEnd, 0, 0);
+        }
 
-    // flush output buffer after every line
-    setvbuf(stdout, NULL, _IOLBF, 0);
+        // cluster is now owned by the list, start looking for next
+        currentCluster = NULL;
+    }
 
-    Arg::parse(argc, argv);
+    frameNumber_t candidateStart;               // first frame of the run below the floor
+    std::vector<unsigned long long> candidate;  // levels of the run below the floor
 
-    /* Check the input is an audiofile. */
-    SF_INFO metadata;
-    SNDFILE* input = sf_open_fd(STDIN_FILENO, SFM_READ, &metadata, SF_FALSE);
-    if (NULL == input) {
-        error("libsndfile error:", false);
-        error(sf_strerror(NULL));
+    static const unsigned kadaptAfter = 60;     // secs of levels needed to estimate the floor
+    LevelHistogram histogram;                   // levels so far, when adapting the threshold
+    unsigned presetThreshold;                   // threshold can't adapt below this
+    unsigned adaptedThreshold;                  // threshold last set by adapting
+    unsigned reportedThreshold;                 // threshold last reported
+    const unsigned fixedThreshold;              // threshold of a further detection, 0 to follow the presets
+    const unsigned fixedExit;                   // level that ends its silences
+
+    unsigned threshold() const
+    {
+        return fixedThreshold ? fixedThreshold : Arg::useThreshold;
     }
 
-    /* Allocate data buffer to contain audio data from one video frame. */
-    const size_t frameSamples = metadata.channels * metadata.samplerate / Arg::kvideoRate;
+    unsigned exitThreshold() const
+    {
+        return fixedThreshold ? fixedExit : Arg::useExitThreshold;
+    }
 
-    int* samples = (int*)malloc(frameSamples * sizeof(int));
-    if (NULL == samples)
-        error("Couldn't allocate memory");
+    void adapt(unsigned long long level)
+    // Raise the threshold to below the programme floor estimated so far, once a second
+    {
+        histogram.add(level);
+        // presets may have changed since
+        if (Arg::useThreshold != adaptedThreshold)
+            presetThreshold = reportedThreshold = Arg::useThreshold;
+        if (histogram.size() < kadaptAfter * Arg::windowRate || 0 != frames % frameCount_t(ceil(Arg::windowRate)))
+            return;
 
-    // create silence/cluster list
-    clist = new ClusterList();
+        const unsigned long long programme = histogram.quantile(Arg::useAdaptQuantile);
+        const unsigned threshold = std::max<double>(presetThreshold,
+                std::min<double>(INT_MAX, programme * pow(10, -Arg::useAdaptive / 20)));
+        Arg::useThreshold = adaptedThreshold = threshold;
+        Arg::useExitThreshold = Arg::exitThreshold(threshold);
+        if (fabs(20 * log10(double(threshold) / reportedThreshold)) >= 1)
+        {
+            char text[100];
+            snprintf(text, sizeof text, "Threshold adapted to %.1f dB at frame %d, programme floor is %.1f dB",
+                     20 * log10(double(threshold) / INT_MAX), Arg::toFrame(frames), 20 * log10(double(programme) / INT_MAX));
+            output.write(prefixdebug, text);
+            reportedThreshold = threshold;
+        }
+    }
+
+public:
+    static const frameCount_t kprobeBatch = 256; // frames between batch probes
 
-    // Kill head of pipeline if timeout happens.
-    signal(SIGALRM, watchdog);
-    sigset_t intmask;
-    sigemptyset(&intmask);
-    sigaddset(&intmask, SIGALRM);
-    sigprocmask(SIG_UNBLOCK, &intmask, NULL);
-    alarm(30);
+    frameNumber_t frames; // frames processed
+    FILE* exportList;     // receives every silence detected
+    FILE* levelList;      // receives the level of every frame
+    unsigned long long exportFloor; // export runs of frames below this instead, 0 for silences
 
-    // Process the input one frame at a time and process cuts along the way.
-    frameNumber_t frames = 0;
-    while (frameSamples == static_cast<size_t>(sf_read_int(input, samples, frameSamples)))
+    Detector(Output& _output, unsigned _threshold = 0) : currentSilence(NULL), currentCluster(NULL),
+                 clist(new ClusterList()), output(_output), candidateStart(0), presetThreshold(Arg::useThreshold),
+                 adaptedThreshold(Arg::useThreshold), reportedThreshold(Arg::useThreshold),
+                 fixedThreshold(_threshold), fixedExit(Arg::exitThreshold(_threshold)), frames(0), exportList(NULL), levelList(NULL), exportFloor(0) {}
+
+    void frame(unsigned long long avgabs)
+    // Process the average audio level of the next frame
     {
-        alarm(30);
         frames++;
+        if (0 == frames % kprobeBatch)
+            PROBE2(batch, frames, avgabs);
 
-        // determine average audio level in this frame
-        unsigned long long avgabs = 0;
-        for (unsigned i = 0; i < frameSamples; i++)
-            avgabs += abs(samples[i]);
-        avgabs = avgabs / frameSamples;
+        if (Arg::useAdaptive)
+            adapt(avgabs);
+        if (levelList)
+        {
+            // levels never exceed INT_MAX
+            const unsigned level = avgabs;
+            fwrite(&level, sizeof level, 1, levelList);
+        }
+
+        // a run of quiet frames can be split into silences at any threshold up to the floor
+        if (exportFloor)
+        {
+            if (avgabs < exportFloor)
+            {
+                if (candidate.empty())
+                    candidateStart = frames;
+                candidate.push_back(avgabs);
+            }
+            else if (!candidate.empty())
+                exportCandidate();
+        }
 
-        // check for a silence
-        if (avgabs < Arg::useThreshold)
+        // check for a silence, which may end at a higher level than it started
+        if (avgabs < (currentSilence ? exitThreshold() : threshold()))
         {
             if (currentSilence)
             {
@@ -393,6 +1178,7 @@ int main(int argc, char **argv)
             {
                 // start a new silence
                 currentSilence = new Silence(frames, avgabs);
+                PROBE2(silence__start, frames, avgabs);
             }
         }
         else if (currentSilence) // transition out of silence
@@ -405,22 +1191,2204 @@ int main(int argc, char **argv)
             processCluster();
         }
     }
-    // Complete any current silence (prog may have finished in silence)
-    if (currentSilence)
+
+    void finish()
+    // Complete detection at end of input
+    {
+        if (!candidate.empty())
+            exportCandidate();
+        // Complete any current silence (prog may have finished in silence)
+        if (currentSilence)
+        {
+            processSilence();
+        }
+        // extend any cluster close to prog end
+        if (currentCluster && frames <= currentCluster->completesAt)
+        {
+            // generate a silence at prog end and extend cluster to it
+            currentSilence = new Silence(frames, 0, Silence::progEnd);
+            processSilence();
+        }
+        // Complete any final cluster
+        if (currentCluster)
+        {
+            processCluster();
+        }
+    }
+
+    bool relevel(const char* filename)
+    // Detect from the level of every frame, written by --levels. Silences are found from bitmasks
+    // of 64 frames, so that only their frames & the noise between clusters are stepped through.
+    // Returns false if the file doesn't hold levels
+    {
+        FILE* file = fopen(filename, "rb");
+        char magic[4];
+        unsigned header[3]; // version, window
+        if (NULL == file)
+            error("Could not open replay file");
+        if (1 != fread(magic, sizeof magic, 1, file) || 0 != memcmp(magic, "SILV", 4))
+        {
+            fclose(file);
+            return false;
+        }
+        if (1 != fread(header, sizeof header, 1, file) || 1 != header[0])
+            error("Levels file is corrupt or from an incompatible version");
+        if (1ULL * header[1] * Arg::useWindowDen != 1ULL * Arg::useWindowNum * header[2])
+            error("Levels file was written with a different analysis window");
+        std::vector<unsigned> levels;
+        unsigned block[4096];
+        size_t read;
+        while (0 != (read = fread(block, sizeof block[0], sizeof block / sizeof block[0], file)))
+            levels.insert(levels.end(), block, block + read);
+        fclose(file);
+
+        // frames that can start a silence, & those that continue one
+        const frameCount_t count = levels.size();
+        std::vector<unsigned long long> starts((count + 63) / 64), continues(starts.size());
+        for (size_t w = 0; w < starts.size(); w++)
+        {
+            const unsigned n = std::min<frameCount_t>(64, count - w * 64);
+            starts[w] = below(&levels[w * 64], n, threshold());
+            continues[w] = (exitThreshold() == threshold() ? starts[w]
+                            : below(&levels[w * 64], n, exitThreshold()));
+        }
+
+        frameNumber_t lastEnd = 0; // end of previous silence
+        unsigned silences = 0;
+        for (frameCount_t f = next(starts, 0, true); f < count; f = next(starts, f, true))
+        {
+            const frameCount_t end = std::min(count, next(continues, f, false));
+            Silence* silence = new Silence(f + 1, levels[f]);
+            for (f++; f < end; f++)
+                silence->extend(f + 1, levels[f]);
+            replayed(silence, lastEnd);
+            silences++;
+        }
+        frames = count;
+        // as the end of a replay, but all frames are known
+        if (currentSilence && lastEnd < frames)
+            processSilence();
+        if (currentCluster && frames > currentCluster->completesAt && frames >= lastEnd + 2)
+            processCluster();
+        printf("%sFound %d silences in the levels of %d frames\n", prefixdebug, silences, frames);
+        return true;
+    }
+
+    void replay(const char* filename)
+    // Process a list of silences exported by another scan, as if their frames had been read.
+    // Runs exported with their levels are split into silences at the current threshold
+    {
+        FILE* list = fopen(filename, "r");
+        if (NULL == list)
+            error("Could not open replay file");
+
+        char* line = NULL;
+        size_t size = 0;
+        frameNumber_t lastEnd = 0; // end of previous silence
+        unsigned count = 0;
+        unsigned exportedExit = 0; // level that ended exported silences
+        while (-1 != getline(&line, &size, list))
+        {
+            frameNumber_t start, end;
+            double power;
+            unsigned exported;
+            int used;
+            if (1 == sscanf(line, "# threshold %u", &exported) && exported != Arg::useThreshold)
+                error("Replay file was exported with a different threshold");
+            if (1 == sscanf(line, "# threshold %u", &exported) || 1 == sscanf(line, "# exit %u", &exported))
+                exportedExit = exported;
+            if (1 == sscanf(line, "# floor %u", &exported) && exported < Arg::useExitThreshold)
+                error("Replay file was exported with a floor below the threshold, plus any hysteresis");
+            unsigned num, den;
+            if (2 == sscanf(line, "# window %u/%u", &num, &den)
+                    && 1ULL * num * Arg::useWindowDen != 1ULL * Arg::useWindowNum * den)
+                error("Replay file was exported with a different analysis window");
+            if ('#' == line[0] || 1 == sscanf(line, "frames %u", &frames))
+                continue;
+            if (exportedExit && exportedExit != Arg::useExitThreshold)
+                error("Replay file was exported with different hysteresis");
+            if (3 != sscanf(line, "%u %u %lf%n", &start, &end, &power, &used) || start <= lastEnd || end < start)
+                error("Replay file is corrupt");
+
+            char* levels = line + used;
+            char* next;
+            unsigned long long level = strtoull(levels, &next, 10);
+            if (next == levels)
+            {
+                // a silence
+                Silence* silence = new Silence(start, power);
+                silence->extend(end, power);
+                replayed(silence, lastEnd);
+                count++;
+                continue;
+            }
+            // a run of frames below the floor: rebuild the silences within it
+            Silence* silence = NULL;
+            for (frameNumber_t f = start; f <= end; f++, level = strtoull(levels = next, &next, 10))
+            {
+                if (next == levels)
+                    error("Replay file is corrupt");
+                if (level < (silence ? exitThreshold() : threshold()))
+                {
+                    if (silence)
+                        silence->extend(f, level);
+                    else
+                        silence = new Silence(f, level);
+                }
+                else if (silence)
+                {
+                    replayed(silence, lastEnd);
+                    silence = NULL;
+                    count++;
+                }
+            }
+            if (silence)
+            {
+                replayed(silence, lastEnd);
+                count++;
+            }
+        }
+        free(line);
+        fclose(list);
+
+        if (frames < lastEnd)
+            error("Replay file is incomplete");
+        // a silence at the end may be continued by the input
+        if (currentSilence && lastEnd < frames)
+            processSilence();
+        if (currentCluster && frames > currentCluster->completesAt && frames >= lastEnd + 2)
+            processCluster();
+
+        printf("%sReplayed %d silences from %d frames\n", prefixdebug, count, frames);
+    }
+
+    void recluster()
+    // Re-evaluate the silences so far with the current presets, reporting all clusters again.
+    // Silences that were too short under the old presets have gone
+    {
+        output.write(prefixreset, "Reclustering");
+        output.event(eventReset, 0, 0, 0, 0, 0);
+        Silence* inProgress = currentSilence;
+        FILE* exporting = exportList;
+        ClusterList* old = clist;
+        delete currentCluster;
+        currentSilence = NULL;
+        currentCluster = NULL;
+        exportList = NULL;
+        clist = new ClusterList();
+
+        frameNumber_t lastEnd = 0;
+        const std::deque<Silence*>& retained = old->silences();
+        for (std::deque<Silence*>::const_iterator s = retained.begin(); s != retained.end(); ++s)
+            if ((*s)->state == Silence::detection)
+            {
+                Silence* silence = new Silence((*s)->start, (*s)->power);
+                silence->extend((*s)->end, (*s)->power);
+                replayed(silence, lastEnd);
+            }
+        delete old;
+
+        // the noise since the last silence may have completed the cluster
+        const frameNumber_t noise = (inProgress ? inProgress->start - 1 : frames);
+        if (currentSilence)
+            processSilence();
+        if (currentCluster && noise > currentCluster->completesAt && noise >= lastEnd + 2)
+            processCluster();
+        currentSilence = inProgress;
+        exportList = exporting;
+    }
+
+    void state(FILE* file) const
+    // Describe detection as it now stands
+    {
+        fprintf(file, "Frame %d, %lu clusters completed\n", frames, clist->clusters());
+        fprintf(file, "Presets (frames): threshold %d, minquiet %d, mindetect %d, minlength %d, maxsep %d, pad %d\n",
+                Arg::useThreshold, Arg::useMinQuiet, Arg::useMinDetect, Arg::useMinLength, Arg::useMaxSep, Arg::usePad);
+        if (currentCluster)
+            fprintf(file, "Cluster %c %d-%d of %d silences, completes at frame %d\n",
+                    currentCluster->state_log[currentCluster->state], currentCluster->start->start,
+                    currentCluster->end->end, currentCluster->silenceCount, currentCluster->completesAt);
+        else
+            fprintf(file, "No cluster in progress\n");
+        if (currentSilence)
+            fprintf(file, "Silence since frame %d\n", currentSilence->start);
+    }
+
+    void snapshot(const char* filename, long long position) const
+    // Save the detection state, so that another process can continue from the next frame
     {
-        processSilence();
+        SnapshotHeader header;
+        memset(&header, 0, sizeof header);
+        memcpy(header.magic, "SILS", 4);
+        header.version = ksnapshotVersion;
+        header.threshold = Arg::useThreshold;
+        header.exitThreshold = Arg::useExitThreshold;
+        header.minQuiet = Arg::useMinQuiet;
+        header.minDetect = Arg::useMinDetect;
+        header.minLength = Arg::useMinLength;
+        header.maxSep = Arg::useMaxSep;
+        header.pad = Arg::usePad;
+        header.windowNum = Arg::useWindowNum;
+        header.windowDen = Arg::useWindowDen;
+        header.frames = frames;
+        header.position = position;
+        header.lastSilenceEnd = clist->lastSilenceEnd;
+        header.lastClusterEnd = clist->lastClusterEnd;
+        header.silence = (NULL != currentSilence);
+        header.cluster = (NULL != currentCluster);
+
+        SilenceState silence;
+        ClusterState cluster;
+        memset(&silence, 0, sizeof silence);
+        memset(&cluster, 0, sizeof cluster);
+        if (currentSilence)
+            save(silence, currentSilence);
+        if (currentCluster)
+        {
+            save(cluster.start, currentCluster->start);
+            save(cluster.end, currentCluster->end);
+            cluster.padStart = currentCluster->padStart;
+            cluster.padEnd = currentCluster->padEnd;
+            cluster.completesAt = currentCluster->completesAt;
+            cluster.length = currentCluster->length;
+            cluster.interval = currentCluster->interval;
+            cluster.silenceCount = currentCluster->silenceCount;
+            cluster.state = currentCluster->state;
+        }
+
+        FILE* file = fopen(filename, "wb");
+        if (NULL == file
+                || 1 != fwrite(&header, sizeof header, 1, file)
+                || (header.silence && 1 != fwrite(&silence, sizeof silence, 1, file))
+                || (header.cluster && 1 != fwrite(&cluster, sizeof cluster, 1, file))
+                || 0 != fclose(file))
+            error("Could not write snapshot");
     }
-    // extend any cluster close to prog end
-    if (currentCluster && frames <= currentCluster->completesAt)
+
+    long long restore(const char* filename)
+    // Continue from a snapshot of another detector, including its parameters.
+    // Returns the input position it had reached
     {
-        // generate a silence at prog end and extend cluster to it
-        currentSilence = new Silence(frames, 0, Silence::progEnd);
-        processSilence();
+        SnapshotHeader header;
+        SilenceState silence;
+        ClusterState cluster;
+        FILE* file = fopen(filename, "rb");
+        if (NULL == file)
+            error("Could not open snapshot");
+        if (1 != fread(&header, sizeof header, 1, file)
+                || 0 != memcmp(header.magic, "SILS", 4) || ksnapshotVersion != header.version
+                || (header.silence && 1 != fread(&silence, sizeof silence, 1, file))
+                || (header.cluster && 1 != fread(&cluster, sizeof cluster, 1, file)))
+            error("Snapshot is corrupt or from an incompatible version");
+        fclose(file);
+        if (1ULL * header.windowNum * Arg::useWindowDen != 1ULL * Arg::useWindowNum * header.windowDen)
+            error("Snapshot was taken with a different analysis window");
+
+        Arg::useThreshold = header.threshold;
+        Arg::useExitThreshold = header.exitThreshold;
+        Arg::useMinQuiet = header.minQuiet;
+        Arg::useMinDetect = header.minDetect;
+        Arg::useMinLength = header.minLength;
+        Arg::useMaxSep = header.maxSep;
+        Arg::usePad = header.pad;
+        frames = header.frames;
+        clist->lastSilenceEnd = header.lastSilenceEnd;
+        clist->lastClusterEnd = header.lastClusterEnd;
+        if (header.silence)
+            currentSilence = load(silence);
+        if (header.cluster)
+        {
+            // the cluster's silences are owned by the list
+            Silence* start = load(cluster.start);
+            Silence* end = (cluster.end.start == cluster.start.start ? start : load(cluster.end));
+            clist->adopt(start);
+            if (end != start)
+                clist->adopt(end);
+            currentCluster = new Cluster(start);
+            currentCluster->end = end;
+            currentCluster->padStart = cluster.padStart;
+            currentCluster->padEnd = cluster.padEnd;
+            currentCluster->completesAt = cluster.completesAt;
+            currentCluster->length = cluster.length;
+            currentCluster->interval = cluster.interval;
+            currentCluster->silenceCount = cluster.silenceCount;
+            currentCluster->state = static_cast<Cluster::state_t>(cluster.state);
+        }
+        printf("%sRestored detection at frame %d, input byte %lld\n", prefixdebug, frames, header.position);
+        return header.position;
     }
-    // Complete any final cluster
-    if (currentCluster)
+};
+const unsigned Detector::ksnapshotVersion;
+const unsigned Detector::kadaptAfter;
+const frameCount_t Detector::kprobeBatch;
+
+class Analysis
+// Measures frame levels. Uses cheaper approximations whilst lagging behind a live recording
+{
+public:
+    // full - every sample, decimated - every <kdecimate> sample, front - decimated front channels only
+    enum mode_t {full, decimated, front};
+    static const char* mode_log[3];
+    static const unsigned kdecimate = 4;     // sample step when decimated
+    static const int kfrontChannels = 3;     // L, R, C
+    static const float kperiodSecs;          // between lag checks
+
+    mode_t mode;
+
+    Analysis(int _channels) : mode(full), channels(_channels) {}
+
+    unsigned long long level(const int* samples, size_t count) const
+    // Determine average audio level of a frame
+    {
+        unsigned long long avgabs = 0;
+        if (full == mode)
+        {
+            for (size_t i = 0; i < count; i++)
+                avgabs += abs(samples[i]);
+            return avgabs / count;
+        }
+        // sample every channel, or just the front ones, of every <kdecimate> sample
+        const int used = (front == mode ? std::min(channels, kfrontChannels) : channels);
+        size_t sampled = 0;
+        for (size_t i = 0; i < count; i += kdecimate * channels, sampled += used)
+            for (int c = 0; c < used; c++)
+                avgabs += abs(samples[i + c]);
+        // averaged over the channels sampled, so levels stay comparable with the threshold whatever the mode
+        return avgabs / sampled;
+    }
+
+    unsigned long long level(const int* samples, size_t count, unsigned* channelLevels) const
+    // Determine average audio level of a frame and, when every sample is analysed,
+    // of each of its first Level::kchannels channels. Others are left alone
+    {
+        if (full != mode || channels > Level::kchannels)
+            return level(samples, count);
+        unsigned long long sums[Level::kchannels] = {0};
+        for (size_t i = 0; i < count; i += channels)
+            for (int c = 0; c < channels; c++)
+                sums[c] += abs(samples[i + c]);
+        // the same sum as level(), so detection is unaffected
+        unsigned long long avgabs = 0;
+        for (int c = 0; c < channels; c++)
+        {
+            avgabs += sums[c];
+            channelLevels[c] = sums[c] * channels / count;
+        }
+        return avgabs / count;
+    }
+
+    static frameCount_t period()
+    // Frames between lag checks, so that they are the same in secs whatever the window
+    {
+        return ceil(kperiodSecs * Arg::windowRate);
+    }
+
+    void check(frameNumber_t frames)
+    // Adjust analysis according to how far the frame lags behind the live recording
+    {
+        timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        const float lag = (now.tv_sec - Arg::useLiveStart) - frames / Arg::windowRate;
+
+        // degrade gradually, but only recover once caught up
+        mode_t wanted = mode;
+        if (lag > Arg::useMaxLag && mode < front)
+            wanted = static_cast<mode_t>(mode + 1);
+        else if (lag < Arg::useMaxLag / 4 && mode > full)
+            wanted = full;
+
+        if (wanted != mode)
+        {
+            mode = wanted;
+            printf("%s%.1f secs behind recording at frame %d, using %s analysis\n",
+                   prefixinfo, lag, frames, mode_log[mode]);
+        }
+    }
+
+private:
+    const int channels;
+};
+const char* Analysis::mode_log[3] = {"full", "decimated", "front channel"};
+const unsigned Analysis::kdecimate;
+const int Analysis::kfrontChannels;
+const float Analysis::kperiodSecs = 1.0;
+
+class Fingerprint
+// Levels of the start of a stream, to recognise another stream carrying the same audio.
+// Recordings of one broadcast decode to nearly the same levels, though frames may be misaligned,
+// so probes are compared by the correlation of their dB levels
+{
+public:
+    static const float kprobeSecs;                // compared
+    static const float kmaxOffsetSecs;            // furthest apart recordings can start
+    static const float kspread;                   // dB deviation that makes a probe distinctive
+    static const float kcorrelation;              // correlation of matching probes
+
+    // each frame, until searching gives up
+    std::vector<unsigned long long> levels;
+    std::vector<float> dB;
+
+    static frameCount_t probeLength()
+    {
+        return ceil(kprobeSecs * Arg::windowRate);
+    }
+
+    static frameCount_t maxOffset()
+    {
+        return ceil(kmaxOffsetSecs * Arg::windowRate);
+    }
+
+    void add(unsigned long long level)
+    {
+        if (levels.size() < maxOffset() + probeLength())
+        {
+            levels.push_back(level);
+            dB.push_back(20 * log10(level + 1.0));
+        }
+    }
+
+    void clear()
+    {
+        std::vector<unsigned long long>().swap(levels);
+        std::vector<float>().swap(dB);
+    }
+
+    bool full() const
+    {
+        return levels.size() == maxOffset() + probeLength();
+    }
+
+    bool distinctive(size_t probe) const
+    // Whether the probe starting at a frame varies enough to identify the audio
+    {
+        const frameCount_t length = probeLength();
+        double sum = 0, squares = 0;
+        for (size_t i = probe; i < probe + length; i++)
+        {
+            sum += dB[i];
+            squares += dB[i] * dB[i];
+        }
+        return squares / length - (sum / length) * (sum / length) >= kspread * kspread;
+    }
+
+    bool matches(const Fingerprint& later, size_t probe, size_t offset) const
+    // Whether the probe of a later stream matches this one <offset> frames on
+    {
+        const frameCount_t length = probeLength();
+        double sumA = 0, sumB = 0, squaresA = 0, squaresB = 0, products = 0;
+        for (size_t i = probe; i < probe + length; i++)
+        {
+            const double a = dB[i + offset], b = later.dB[i];
+            sumA += a;
+            sumB += b;
+            squaresA += a * a;
+            squaresB += b * b;
+            products += a * b;
+        }
+        const double covariance = products - sumA * sumB / length;
+        const double varianceA = squaresA - sumA * sumA / length;
+        const double varianceB = squaresB - sumB * sumB / length;
+        return varianceA > 0 && covariance >= kcorrelation * sqrt(varianceA * varianceB);
+    }
+};
+const float Fingerprint::kprobeSecs = 30;
+const float Fingerprint::kmaxOffsetSecs = 15 * 60;
+const float Fingerprint::kspread = 3;
+const float Fingerprint::kcorrelation = 0.95;
+
+class Governor
+// Limits the resources used so that recordings never suffer.
+// Pausing the reader also holds up the pipeline writing to it
+{
+public:
+    static const float kbatchSecs;  // of frames between pacing checks
+
+    double throttled;  // total secs paused
+
+    Governor() : throttled(0)
+    {
+        batchCpu = now(CLOCK_THREAD_CPUTIME_ID);
+        batchStart = now(CLOCK_MONOTONIC);
+    }
+
+    static frameCount_t batch()
+    // Frames between pacing checks
+    {
+        return ceil(kbatchSecs * Arg::windowRate);
+    }
+
+    static void background()
+    // Run at idle CPU & I/O priority
+    {
+        sched_param param = {0};
+        if (0 != sched_setscheduler(0, SCHED_IDLE, &param))
+        {
+            // fall back to lowest normal priority
+            if (0 != setpriority(PRIO_PROCESS, 0, 19))
+                error("Could not lower CPU priority", false);
+        }
+        if (0 != syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT))
+            error("Could not lower I/O priority", false);
+    }
+
+    void pace()
+    // Pause for long enough that the last batch of frames was within the CPU budget
+    {
+        const double cpu = now(CLOCK_THREAD_CPUTIME_ID);
+        const double wall = now(CLOCK_MONOTONIC);
+        const double wait = (cpu - batchCpu) / Arg::useCpuBudget - (wall - batchStart);
+        if (wait > 0)
+        {
+            timespec pause = {static_cast<time_t>(wait), static_cast<long>(fmod(wait, 1) * 1e9)};
+            while (0 != nanosleep(&pause, &pause) && EINTR == errno)
+                ;
+            throttled += wait;
+        }
+        batchCpu = cpu;
+        batchStart = wait > 0 ? wall + wait : wall;
+    }
+
+private:
+    double batchCpu;   // thread CPU secs at start of batch
+    double batchStart; // time at start of batch
+
+    static double now(clockid_t clock)
+    {
+        timespec t;
+        clock_gettime(clock, &t);
+        return t.tv_sec + t.tv_nsec / 1e9;
+    }
+};
+const float Governor::kbatchSecs = 1.0;
+
+class CachePolicy
+// Reads a file sequentially without flooding the page cache: the kernel is asked to read a
+// bounded window ahead and, unless keeping the cache, data that has been read is dropped
+{
+public:
+    static const off_t kwindow = 4 << 20; // readahead/drop granularity
+
+    unsigned long long dropped; // bytes dropped from the cache
+
+    CachePolicy(int _fd, off_t start) : dropped(0), fd(_fd), ahead(start), behind(start), scattered(false)
+    {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    void scatter()
+    // Reads will jump about the file: don't read ahead of them or drop behind them
+    {
+        scattered = true;
+        posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+    }
+
+    void advance(off_t pos)
+    // Update cache after everything before pos has been read
+    {
+        if (scattered)
+            return;
+        // keep the next window on its way
+        if (pos + kwindow > ahead)
+        {
+            ahead = std::max(ahead, pos);
+            posix_fadvise(fd, ahead, kwindow, POSIX_FADV_WILLNEED);
+            ahead += kwindow;
+        }
+        if (pos - behind >= kwindow)
+            drop(pos);
+    }
+
+    void drop(off_t pos)
+    // Drop everything before pos from the cache
+    {
+        if (Arg::useKeepCache || pos <= behind)
+            return;
+        posix_fadvise(fd, behind, pos - behind, POSIX_FADV_DONTNEED);
+        dropped += pos - behind;
+        behind = pos;
+    }
+
+private:
+    const int fd;
+    off_t ahead;   // end of readahead requested
+    off_t behind;  // end of data dropped
+    bool scattered; // reads aren't sequential
+};
+const off_t CachePolicy::kwindow;
+
+class Input
+// Buffered reader of the audio stream, presented to libsndfile as virtual I/O.
+// An empty pipe is waited on with poll() so idle detection costs nothing per frame
+{
+private:
+    const int fd;
+    bool seekable;             // input is a file rather than a pipe
+    bool ended;                // no more data will be read
+    bool retain;               // keep all data read so far, so that libsndfile can seek back
+    std::vector<char> buffer;  // data from the stream
+    size_t pos;                // read position in buffer
+    size_t filled;             // amount of valid data in buffer
+    sf_count_t offset;         // stream position of buffer start
+    CachePolicy* cache;        // manages page cache for files
+
+    bool idle()
+    // Handle input that has been idle for the idle period. Returns false to stop reading
+    {
+        switch (Arg::useIdleAction)
+        {
+        case Arg::idleKill:
+            // kill head of pipeline, which will close it and deliver end of file
+            if (0 != tail_pid)
+            {
+                printf("%sNo input for %.1f secs, killing process %d\n",
+                       prefixinfo, Arg::useIdleTimeout / 1000.0, tail_pid);
+                kill(tail_pid, SIGTERM);
+                tail_pid = 0;
+            }
+            return true;
+        case Arg::idleFinish:
+            printf("%sNo input for %.1f secs, finishing\n", prefixinfo, Arg::useIdleTimeout / 1000.0);
+            return false;
+        default:
+            printf("%sNo input for %.1f secs, waiting\n", prefixdebug, Arg::useIdleTimeout / 1000.0);
+            return true;
+        }
+    }
+
+    bool fill(bool wait = true)
+    // Read more of the stream into the buffer, waiting if none is available.
+    // Returns false at end of stream, or if none is available & not waiting
+    {
+        if (ended)
+            return false;
+
+        // discard consumed data unless it may be needed again
+        if (!retain && pos > 0)
+        {
+            memmove(&buffer[0], &buffer[pos], filled - pos);
+            offset += pos;
+            filled -= pos;
+            pos = 0;
+        }
+        if (filled == buffer.size())
+            buffer.resize(2 * buffer.size());
+
+        while (true)
+        {
+            ssize_t got = ::read(fd, &buffer[filled], buffer.size() - filled);
+            if (got > 0)
+            {
+                filled += got;
+                // data before the buffer has been analysed
+                if (cache)
+                {
+                    cache->advance(offset + filled);
+                    cache->drop(offset);
+                }
+                return true;
+            }
+            else if (0 == got)
+                break;
+            else if (EAGAIN == errno || EWOULDBLOCK == errno)
+            {
+                // pipe is empty: wait for the writer or the idle period
+                if (!wait)
+                    return false;
+                PROBE1(input__stall, offset + filled);
+                pollfd waitfd = {fd, POLLIN, 0};
+                int ready = poll(&waitfd, 1, Arg::useIdleTimeout);
+                PROBE2(input__resume, offset + filled, ready);
+                if (ready < 0 && EINTR != errno)
+                {
+                    error("Failed waiting for input", false);
+                    break;
+                }
+                if (0 == ready && !idle())
+                    break;
+            }
+            else if (EINTR != errno)
+            {
+                error("Failed reading input", false);
+                break;
+            }
+        }
+        ended = true;
+        return false;
+    }
+
+    static sf_count_t vioLength(void* in)
+    {
+        return static_cast<Input*>(in)->length();
+    }
+    static sf_count_t vioSeek(sf_count_t offset, int whence, void* in)
+    {
+        return static_cast<Input*>(in)->seek(offset, whence);
+    }
+    static sf_count_t vioRead(void* ptr, sf_count_t count, void* in)
+    {
+        return static_cast<Input*>(in)->read(ptr, count);
+    }
+    static sf_count_t vioWrite(const void* ptr, sf_count_t count, void* in)
+    {
+        return 0;
+    }
+    static sf_count_t vioTell(void* in)
+    {
+        return static_cast<Input*>(in)->position();
+    }
+
+public:
+    static SF_VIRTUAL_IO vio; // libsndfile callbacks
+
+    Input(int _fd)
+        : fd(_fd), ended(false), retain(true), buffer(1 << 16), pos(0), filled(0), offset(0), cache(NULL)
+    {
+        struct stat info;
+        seekable = (0 == fstat(fd, &info) && S_ISREG(info.st_mode));
+        // pipes are polled when empty rather than blocking in read
+        if (!seekable)
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        else
+            cache = new CachePolicy(fd, lseek(fd, 0, SEEK_CUR));
+    }
+
+    ~Input()
+    {
+        if (cache)
+        {
+            cache->drop(position());
+            if (cache->dropped)
+                printf("%sDropped %llu bytes of input from cache\n", prefixdebug, cache->dropped);
+        }
+        delete cache;
+    }
+
+    void release()
+    // Allow data that has been read to be discarded
+    {
+        retain = false;
+    }
+
+    void scatter()
+    // Reads will jump about the file
+    {
+        if (cache)
+            cache->scatter();
+    }
+
+    sf_count_t position() const
+    // Stream position of next read
+    {
+        return offset + pos;
+    }
+
+    sf_count_t length() const
+    // Length of the stream, if known
+    {
+        struct stat info;
+        if (seekable && 0 == fstat(fd, &info))
+            return info.st_size;
+        return SF_COUNT_MAX;
+    }
+
+    bool ready(size_t bytes)
+    // Whether bytes can be read without waiting, taking in what the pipe holds so far
+    {
+        while (!seekable && !ended && filled - pos < bytes)
+            if (!fill(false))
+                break;
+        return seekable || ended || filled - pos >= bytes;
+    }
+
+    sf_count_t read(void* ptr, sf_count_t count)
+    // Read count bytes, waiting for them if necessary. Only returns fewer at end of stream
+    {
+        sf_count_t done = 0;
+        while (done < count && (pos < filled || fill()))
+        {
+            size_t chunk = std::min(static_cast<size_t>(count - done), filled - pos);
+            memcpy(static_cast<char*>(ptr) + done, &buffer[pos], chunk);
+            pos += chunk;
+            done += chunk;
+        }
+        return done;
+    }
+
+    sf_count_t seek(sf_count_t target, int whence)
+    // Move the read position. Pipes can only move within the buffer or forwards
+    {
+        if (SEEK_CUR == whence)
+            target += position();
+        else if (SEEK_END == whence)
+            target += length();
+
+        // skip forwards through a pipe
+        while (!seekable && target > offset + static_cast<sf_count_t>(filled))
+        {
+            pos = filled;
+            if (!fill())
+                break;
+        }
+        if (target >= offset && target <= offset + static_cast<sf_count_t>(filled))
+        {
+            pos = target - offset;
+            return target;
+        }
+        if (seekable && target == lseek(fd, target, SEEK_SET))
+        {
+            offset = target;
+            pos = filled = 0;
+            ended = false;
+            return target;
+        }
+        return -1;
+    }
+};
+SF_VIRTUAL_IO Input::vio = {vioLength, vioSeek, vioRead, vioWrite, vioTell};
+
+template <class Record>
+class Ring
+// Publishes records to readers of a shared memory file, never waiting for them
+{
+public:
+    static const unsigned kversion = 4;
+
+    Ring(const char* path, const char* magic, unsigned _size, unsigned channels = 0)
+        : size(_size), header(NULL), records(NULL)
+    {
+        const size_t bytes = sizeof(RingHeader) + size * sizeof(Record);
+        struct stat st;
+        int fd = open(path, O_RDWR | O_CREAT, 0644);
+        if (fd < 0 || fstat(fd, &st) < 0 || (size_t(st.st_size) != bytes && ftruncate(fd, bytes) < 0))
+            error("Could not create ring");
+        void* map = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (MAP_FAILED == map)
+            error("Could not map ring");
+        header = static_cast<RingHeader*>(map);
+        records = reinterpret_cast<Record*>(header + 1);
+
+        // continue a ring that the process this one restored from was writing to, if it is compatible
+        if (size_t(st.st_size) != bytes || 0 != memcmp(header->magic, magic, 4) || kversion != header->version
+                || size != header->size || sizeof(Record) != header->recordSize
+                || Arg::useWindowNum != header->windowNum || Arg::useWindowDen != header->windowDen
+                || channels != header->channels)
+        {
+            memset(header, 0, sizeof *header);
+            header->version = kversion;
+            header->size = size;
+            header->recordSize = sizeof(Record);
+            header->windowNum = Arg::useWindowNum;
+            header->windowDen = Arg::useWindowDen;
+            header->channels = channels;
+            // readers check the magic first
+            __atomic_thread_fence(__ATOMIC_RELEASE);
+            memcpy(header->magic, magic, 4);
+        }
+        // a new detection starts the ring afresh, leaving only the readers waiting
+        else if (!Arg::useRestore)
+        {
+            for (unsigned r = 0; r < size; r++)
+                __atomic_store_n(&records[r].sequence, 0ULL, __ATOMIC_RELAXED);
+            __atomic_store_n(&header->first, 0ULL, __ATOMIC_SEQ_CST);
+            __atomic_store_n(&header->written, 0ULL, __ATOMIC_SEQ_CST);
+        }
+        __atomic_store_n(&header->finished, 0, __ATOMIC_RELEASE);
+    }
+
+    ~Ring()
+    {
+        __atomic_store_n(&header->finished, 1, __ATOMIC_SEQ_CST);
+        wake();
+        munmap(header, sizeof(RingHeader) + size * sizeof(Record));
+    }
+
+    void publish(Record record)
+    // Publish a record, numbered by its sequence or the next one if that is 0
+    {
+        const unsigned long long sequence = (record.sequence ? record.sequence : header->written + 1);
+        Record* slot = &records[(sequence - 1) % size];
+        // readers discard a slot whose sequence changes whilst they copy it
+        record.sequence = 0;
+        __atomic_store_n(&slot->sequence, 0ULL, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        *slot = record;
+        __atomic_store_n(&slot->sequence, sequence, __ATOMIC_RELEASE);
+        // levels are numbered by frame, so needn't start from 1
+        if (0 == header->first)
+            __atomic_store_n(&header->first, sequence, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&header->written, sequence, __ATOMIC_SEQ_CST);
+        wake();
+    }
+
+private:
+    const unsigned size;
+    RingHeader* header;
+    Record* records;
+
+    void wake()
+    // Wake readers, making a syscall only if some are waiting
+    {
+        __atomic_add_fetch(&header->wakeups, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&header->waiting, __ATOMIC_SEQ_CST))
+            syscall(SYS_futex, &header->wakeups, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+};
+template <class Record> const unsigned Ring<Record>::kversion;
+
+class RingOutput : public Output
+// Writes reports to stdout & publishes them as events to a ring
+{
+public:
+    static const unsigned ksize = 4096; // events: 128KB
+
+    RingOutput(const char* path) : ring(path, "SILR", ksize) {}
+
+    ~RingOutput()
+    {
+        event(eventEnd, 0, 0, 0, 0, 0);
+    }
+
+    void event(eventKind_t kind, char state, frameNumber_t start, frameNumber_t end, frameCount_t interval, int power)
+    {
+        Event e;
+        memset(&e, 0, sizeof e);
+        e.kind = kind;
+        e.state = state;
+        e.start = start;
+        e.end = end;
+        e.interval = interval;
+        e.power = power;
+        ring.publish(e);
+    }
+
+private:
+    Ring<Event> ring;
+};
+const unsigned RingOutput::ksize;
+
+class LevelFeed
+// Publishes the level of every frame to a ring
+{
+public:
+    static const unsigned ksize = 45000; // frames: 30 mins of video frames, 2MB
+
+    LevelFeed(const char* path, int channels) : ring(path, "SILL", ksize, channels) {}
+
+    unsigned long long level(const Analysis& analysis, const int* samples, size_t count, frameNumber_t frame)
+    // Measure & publish the level of a frame
+    {
+        Level record;
+        memset(&record, 0, sizeof record);
+        const unsigned long long level = analysis.level(samples, count, record.channel);
+        record.sequence = frame;
+        record.level = level;
+        ring.publish(record);
+        return level;
+    }
+
+private:
+    Ring<Level> ring;
+};
+const unsigned LevelFeed::ksize;
+
+const int Level::kchannels;
+
+class FlightRecorder
+// Keeps the levels of the last 30 mins of frames & the reports during them, so that a bad cut
+// can be analysed after the event. Recording a frame costs a store
+{
+public:
+    static const unsigned kminutes = 30;
+    static const unsigned kevents = 4096;
+
+    const char* anomaly; // reason for a dump that has been requested
+
+    FlightRecorder(const char* _path) : anomaly(NULL), levels(ceil(kminutes * 60 * Arg::windowRate)), events(kevents),
+        frames(0), reported(0), clusterState(0), detector(NULL), path(_path) {}
+
+    void watch(const Detector* _detector)
+    {
+        detector = _detector;
+    }
+
+    void frame(frameNumber_t frame, unsigned long long level)
+    {
+        levels[frame % levels.size()] = level;
+        frames = frame;
+    }
+
+    void event(eventKind_t kind, char state, frameNumber_t start, frameNumber_t end, frameCount_t interval, int power)
+    {
+        Event& e = events[reported++ % kevents];
+        e.sequence = reported;
+        e.kind = kind;
+        e.state = state;
+        e.start = start;
+        e.end = end;
+        e.interval = interval;
+        e.power = power;
+        // a cut follows the report of its cluster. Preroll & postroll are cut whatever their length
+        if (eventCluster == kind)
+            clusterState = state;
+        else if (eventCut == kind && Cluster::state_log[Cluster::advert] == clusterState)
+        {
+            // padding is taken from both ends of a cut, which must otherwise be a whole advert break
+            const frameCount_t unpadded = end - start + 1 + 2 * Arg::toFrames(Arg::usePad);
+            if (int(end) < int(start) || unpadded < Arg::toFrames(Arg::useMinLength))
+                anomaly = "Cut is shorter than minlength";
+        }
+    }
+
+    void dump(const char* reason)
+    // Write everything recorded to the dump file, replacing any earlier dump
+    {
+        static const char* name[6] = {"", "silence", "cluster", "cut", "reset", "end"};
+        FILE* file = fopen(path, "w");
+        if (NULL == file)
+        {
+            error("Could not write flight recorder", false);
+            return;
+        }
+        const frameNumber_t first = (frames > levels.size() ? frames - levels.size() + 1 : 1);
+        fprintf(file, "# silence flight recorder: %s\n", reason);
+        fprintf(file, "# window %u/%u, fps %u/%u, frames %d-%d\n",
+                Arg::useWindowNum, Arg::useWindowDen, Arg::useFpsNum, Arg::useFpsDen, first, frames);
+        if (detector)
+        {
+            fprintf(file, "# ");
+            detector->state(file);
+        }
+        fprintf(file, "# event kind state start end interval power (video frames)\n");
+        for (unsigned long long r = (reported > kevents ? reported - kevents : 0); r < reported; r++)
+        {
+            const Event& e = events[r % kevents];
+            fprintf(file, "event %s %c %d %d %d %d\n", name[int(e.kind)], (e.state ? e.state : '-'),
+                    e.start, e.end, e.interval, e.power);
+        }
+        fprintf(file, "# frame level (analysis windows)\n");
+        for (frameNumber_t f = first; f <= frames && frames; f++)
+            fprintf(file, "%d %u\n", f, levels[f % levels.size()]);
+        if (0 != fclose(file))
+            error("Could not write flight recorder", false);
+        else
+            printf("%sFlight recorder dumped to %s: %s\n", prefixinfo, path, reason);
+    }
+
+private:
+    std::vector<unsigned> levels;
+    std::vector<Event> events;
+    frameNumber_t frames;        // latest frame recorded
+    unsigned long long reported; // events recorded
+    char clusterState;           // of the latest cluster reported
+    const Detector* detector;    // whose state is dumped
+    const char* path;            // of the dump file
+};
+const unsigned FlightRecorder::kminutes;
+const unsigned FlightRecorder::kevents;
+
+// dumped when exiting on an error, before detection would have ended normally
+FlightRecorder* flightRecorder = NULL;
+void dumpAtExit()
+{
+    if (flightRecorder)
+        flightRecorder->dump("Exited");
+}
+
+class RecordedOutput : public Output
+// Passes reports on, recording their events
+{
+public:
+    RecordedOutput(Output& _output, FlightRecorder& _recorder) : output(_output), recorder(_recorder) {}
+
+    void write(const char* prefix, const char* text)
+    {
+        output.write(prefix, text);
+    }
+
+    void event(eventKind_t kind, char state, frameNumber_t start, frameNumber_t end, frameCount_t interval, int power)
+    {
+        recorder.event(kind, state, start, end, interval, power);
+        output.event(kind, state, start, end, interval, power);
+    }
+
+private:
+    Output& output;
+    FlightRecorder& recorder;
+};
+
+template <class Record>
+class RingReader
+// Follows the records of a ring, from the oldest it holds
+{
+public:
+    RingReader(const char* path, const char* magic) : header(NULL), records(NULL), next(1), bytes(0)
+    {
+        int fd = open(path, O_RDWR);
+        RingHeader first;
+        if (fd < 0 || sizeof first != ::read(fd, &first, sizeof first) || 0 != memcmp(first.magic, magic, 4)
+                || Ring<Record>::kversion != first.version || sizeof(Record) != first.recordSize || 0 == first.size)
+            error("Could not open ring, or it is from an incompatible version");
+        bytes = sizeof(RingHeader) + first.size * sizeof(Record);
+        void* map = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (MAP_FAILED == map)
+            error("Could not map ring");
+        header = static_cast<RingHeader*>(map);
+        records = reinterpret_cast<const Record*>(header + 1);
+        next = oldest();
+    }
+
+    ~RingReader()
+    {
+        munmap(header, bytes);
+    }
+
+    const RingHeader& info() const
+    {
+        return *header;
+    }
+
+    bool read(Record& record)
+    // Copy the next record, waiting for it. Returns false once the writer has finished
+    {
+        for (;;)
+        {
+            const int seen = __atomic_load_n(&header->wakeups, __ATOMIC_SEQ_CST);
+            next = std::max(next, oldest());
+            while (next <= __atomic_load_n(&header->written, __ATOMIC_SEQ_CST))
+            {
+                const Record* slot = &records[(next - 1) % header->size];
+                const unsigned long long sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+                record = *slot;
+                __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                if (sequence == next && __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) == next)
+                {
+                    record.sequence = next++;
+                    return true;
+                }
+                // a slot that has never been written, or holds an earlier record, where the writer
+                // skipped sequences
+                const unsigned long long skip = oldest();
+                if (0 == sequence || sequence < next || skip <= next)
+                {
+                    next++;
+                    continue;
+                }
+                // the writer has lapped this reader
+                printf("%sMissed %llu records\n", prefixerr, skip - next);
+                next = skip;
+            }
+            if (__atomic_load_n(&header->finished, __ATOMIC_SEQ_CST)
+                    && next > __atomic_load_n(&header->written, __ATOMIC_SEQ_CST))
+                return false;
+
+            // wait for the writer. Time out in case it died
+            __atomic_add_fetch(&header->waiting, 1, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&header->written, __ATOMIC_SEQ_CST) < next)
+            {
+                timespec timeout = {1, 0};
+                syscall(SYS_futex, &header->wakeups, FUTEX_WAIT, seen, &timeout, NULL, 0);
+            }
+            __atomic_sub_fetch(&header->waiting, 1, __ATOMIC_SEQ_CST);
+        }
+    }
+
+private:
+    RingHeader* header;
+    const Record* records;
+    unsigned long long next; // sequence to read
+    size_t bytes;
+
+    unsigned long long oldest() const
+    // Sequence of the oldest record the ring may hold
+    {
+        const unsigned long long first = __atomic_load_n(&header->first, __ATOMIC_SEQ_CST);
+        const unsigned long long written = __atomic_load_n(&header->written, __ATOMIC_SEQ_CST);
+        return std::max(std::max(first, 1ULL), written > header->size ? written - header->size + 1 : 1);
+    }
+};
+
+int readRing()
+// Print the records of a ring as they are published, until its writer finishes
+{
+    int fd = open(Arg::useReadRing, O_RDONLY);
+    char magic[4];
+    if (fd < 0 || sizeof magic != read(fd, magic, sizeof magic))
+        error("Could not open ring");
+    close(fd);
+
+    if (0 == memcmp(magic, "SILL", 4))
+    {
+        RingReader<Level> reader(Arg::useReadRing, "SILL");
+        const int channels = std::min<int>(reader.info().channels, Level::kchannels);
+        Level record;
+        while (reader.read(record))
+        {
+            printf("%llu %u", record.sequence, record.level);
+            for (int c = 0; c < channels; c++)
+                printf(" %u", record.channel[c]);
+            printf("\n");
+        }
+        return 0;
+    }
+
+    static const char* name[6] = {"", "silence", "cluster", "cut", "reset", "end"};
+    RingReader<Event> reader(Arg::useReadRing, "SILR");
+    Event e;
+    while (reader.read(e))
+        printf("%llu %s %c %d %d %d %d\n", e.sequence,
+               (e.kind > 0 && e.kind <= eventEnd ? name[int(e.kind)] : "unknown"), (e.state ? e.state : '-'),
+               e.start, e.end, e.interval, e.power);
+    return 0;
+}
+
+class TsFilter
+// Keeps the packets of an MPEG-TS that carry one audio stream, and the PAT & PMT that describe it,
+// so that the decoder never sees the video. Or reassembles the payloads of its PES packets into
+// the elementary stream. Packets are checked where they are read & only those kept are copied
+{
+public:
+    static const size_t kpacket = 188;
+    static const char ksync = 0x47;
+
+    unsigned long long kept;     // bytes
+    unsigned discontinuities;    // of the audio packets
+
+    TsFilter(int _wanted, bool _elementary) : kept(0), discontinuities(0), wanted(_wanted),
+        elementary(_elementary), checked(false), passthrough(false), pmt(-1), audio(_wanted > 0 ? _wanted : -1),
+        described(false), continuity(-1), inPes(false) {}
+
+    void filter(const char* data, size_t size, std::vector<char>& out)
+    // Append what is kept of the next bytes of the stream to out
+    {
+        if (!checked)
+        {
+            // files that aren't TS are passed on whole, which takes a few packets to tell
+            partial.insert(partial.end(), data, data + size);
+            if (partial.size() < 4 * kpacket)
+                return;
+            std::vector<char> start;
+            start.swap(partial);
+            const size_t at = sync(&start[0], start.size(), 0);
+            checked = true;
+            passthrough = (at >= kpacket || ksync != start[at + 2 * kpacket]);
+            if (passthrough)
+                fprintf(messages, "%sInput isn't an MPEG-TS, feeding all of it\n", prefixinfo);
+            filter(&start[0], start.size(), out);
+            return;
+        }
+        if (passthrough)
+        {
+            out.insert(out.end(), data, data + size);
+            kept += size;
+            return;
+        }
+
+        // complete a packet split between reads
+        if (!partial.empty())
+        {
+            const size_t needed = std::min(size, kpacket - partial.size());
+            partial.insert(partial.end(), data, data + needed);
+            data += needed;
+            size -= needed;
+            if (partial.size() < kpacket)
+                return;
+            packet(reinterpret_cast<const unsigned char*>(&partial[0]), out);
+            partial.clear();
+            // the next packet may not follow on
+            if (size && ksync != data[0])
+            {
+                const size_t at = sync(data, size, 0);
+                data += at;
+                size -= at;
+            }
+        }
+        size_t i = 0;
+        while (i + kpacket <= size)
+        {
+            if (ksync == data[i])
+            {
+                packet(reinterpret_cast<const unsigned char*>(data + i), out);
+                i += kpacket;
+            }
+            else
+                i = sync(data, size, i + 1);
+        }
+        partial.assign(data + i, data + size);
+    }
+
+private:
+    const int wanted;       // audio PID, 0 for the first
+    const bool elementary;
+    bool checked;           // whether the input has been checked for TS
+    bool passthrough;       // input isn't TS
+    int pmt;                // PID of the PMT of the first programme, -1 until the PAT is read
+    int audio;              // PID kept, -1 until the PMT is read when none is wanted
+    bool described;         // the PMT has been read for the audio PID
+    int continuity;         // counter of the last audio packet
+    bool inPes;             // the audio packets are within a PES packet that can be reassembled
+    std::vector<char> partial; // packet split between reads
+
+    static size_t sync(const char* data, size_t size, size_t from)
+    // Offset of the next packet: a sync byte with another a packet on, as far as data reaches.
+    // Returns size if there is none
+    {
+        size_t i = from;
+#ifdef __SSE2__
+        const __m128i syncs = _mm_set1_epi8(ksync);
+        for (; i + 16 <= size; i += 16)
+        {
+            for (int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + i)), syncs));
+                 mask; mask &= mask - 1)
+            {
+                const size_t at = i + __builtin_ctz(mask);
+                if (at + kpacket >= size || ksync == data[at + kpacket])
+                    return at;
+            }
+        }
+#endif
+        for (; i < size; i++)
+            if (ksync == data[i] && (i + kpacket >= size || ksync == data[i + kpacket]))
+                return i;
+        return size;
+    }
+
+    static const unsigned char* section(const unsigned char* payload, size_t size, int table, size_t& length)
+    // The table section starting in a payload, if it is all there. Sets its length before the CRC
+    {
+        const size_t start = 1 + payload[0]; // after the pointer field
+        if (start + 3 > size || table != payload[start])
+            return NULL;
+        const unsigned char* s = payload + start;
+        length = 3 + (((s[1] & 0x0f) << 8) | s[2]);
+        if (start + length > size || length < 12 + 4)
+            return NULL;
+        length -= 4;
+        return s;
+    }
+
+    static const char* format(int type, const unsigned char* descriptors, size_t length)
+    // Demuxer of an elementary stream type that a decoder can read, or NULL if it isn't audio
+    {
+        switch (type)
+        {
+        case 0x03:
+        case 0x04:
+            return "mp3";
+        case 0x0f:
+            return "aac";
+        case 0x11:
+            return "loas";
+        case 0x81:
+            return "ac3";
+        case 0x87:
+            return "eac3";
+        case 0x06:
+            // DVB private data carrying audio is identified by a descriptor
+            for (size_t d = 0; d + 2 <= length; d += 2 + descriptors[d + 1])
+                if (0x6a == descriptors[d])
+                    return "ac3";
+                else if (0x7a == descriptors[d])
+                    return "eac3";
+        }
+        return NULL;
+    }
+
+    void readPat(const unsigned char* payload, size_t size)
+    // Find the PMT of the first programme
+    {
+        size_t length;
+        const unsigned char* s = section(payload, size, 0x00, length);
+        for (size_t i = 8; s && i + 4 <= length; i += 4)
+            if (s[i] || s[i + 1]) // programme 0 is the network PID
+            {
+                pmt = ((s[i + 2] & 0x1f) << 8) | s[i + 3];
+                return;
+            }
+    }
+
+    void readPmt(const unsigned char* payload, size_t size)
+    // Find the first audio PID, when none is wanted, & the format of the audio fed
+    {
+        size_t length;
+        const unsigned char* s = section(payload, size, 0x02, length);
+        if (!s)
+            return;
+        int first = -1;
+        const char* name = NULL;
+        const char* firstName = NULL;
+        for (size_t i = 12 + (((s[10] & 0x0f) << 8) | s[11]); i + 5 <= length;)
+        {
+            const int pid = ((s[i + 1] & 0x1f) << 8) | s[i + 2];
+            const size_t info = ((s[i + 3] & 0x0f) << 8) | s[i + 4];
+            const char* demuxer = format(s[i], s + i + 5, std::min(info, length - i - 5));
+            if (demuxer && first < 0)
+            {
+                first = pid;
+                firstName = demuxer;
+            }
+            if (demuxer && pid == wanted)
+                name = demuxer;
+            i += 5 + info;
+        }
+        if (wanted && !name)
+            fprintf(messages, "%sAudio PID 0x%x isn't in the PMT\n", prefixinfo, wanted);
+        else if (!wanted && first >= 0)
+        {
+            audio = first;
+            name = firstName;
+        }
+        described = (audio >= 0);
+        if (name)
+            fprintf(messages, "%sFeeding audio PID 0x%x, format %s\n", prefixinfo, audio, name);
+    }
+
+    void copy(const unsigned char* from, size_t size, std::vector<char>& out)
+    {
+        out.insert(out.end(), from, from + size);
+        kept += size;
+    }
+
+    void packet(const unsigned char* p, std::vector<char>& out)
+    // Keep what's needed of a packet
+    {
+        const int pid = ((p[1] & 0x1f) << 8) | p[2];
+        const bool unitStart = p[1] & 0x40;
+        const int control = (p[3] >> 4) & 3;
+        const size_t payload = (control & 2) ? 5 + p[4] : 4;
+        // transport errors & packets without payload carry nothing useful
+        if ((p[1] & 0x80) || !(control & 1) || payload >= kpacket)
+            return;
+
+        if (0 == pid || pid == pmt)
+        {
+            if (unitStart && 0 == pid && pmt < 0)
+                readPat(p + payload, kpacket - payload);
+            else if (unitStart && pid == pmt && !described)
+                readPmt(p + payload, kpacket - payload);
+            if (!elementary)
+                copy(p, kpacket, out);
+            return;
+        }
+        if (pid != audio)
+            return;
+        if (!elementary)
+        {
+            copy(p, kpacket, out);
+            return;
+        }
+
+        // a lost packet leaves the PES packet incomplete, so skip to the next. Duplicates are dropped
+        const int counter = p[3] & 0x0f;
+        if (counter == continuity)
+            return;
+        if (continuity >= 0 && counter != ((continuity + 1) & 0x0f))
+        {
+            discontinuities++;
+            inPes = false;
+        }
+        continuity = counter;
+
+        const unsigned char* data = p + payload;
+        size_t size = kpacket - payload;
+        if (unitStart)
+        {
+            // PES header: start code, stream id, length, flags & the length of the rest of the header
+            inPes = (size >= 9 && 0 == data[0] && 0 == data[1] && 1 == data[2] && size_t(9 + data[8]) <= size);
+            if (!inPes)
+                return;
+            size -= 9 + data[8];
+            data += 9 + data[8];
+        }
+        if (inPes)
+            copy(data, size, out);
+    }
+};
+const size_t TsFilter::kpacket;
+const char TsFilter::ksync;
+
+void feedOut(const char* data, size_t size)
+// Write everything to stdout
+{
+    for (size_t sent = 0; sent < size;)
+    {
+        const ssize_t n = write(STDOUT_FILENO, data + sent, size - sent);
+        if (n < 0 && EINTR != errno)
+            error("Could not write feed");
+        if (n > 0)
+            sent += n;
+    }
+}
+
+int feed()
+// Copy (part of) a file to stdout, optionally following it as it grows
+{
+    const int fd = open(Arg::useFeed, O_RDONLY);
+    if (fd < 0)
+        error("Could not open file to feed");
+
+    const size_t kblock = 1 << 20;
+    const int kpoll = 200; // ms between checks of a file that has stopped growing
+    std::vector<char> block(kblock);
+    CachePolicy cache(fd, Arg::useFeedFrom);
+    const off_t end = (Arg::useFeedLength ? Arg::useFeedFrom + Arg::useFeedLength : LLONG_MAX);
+    off_t pos = Arg::useFeedFrom;
+    int idle = 0; // ms since file last grew
+    TsFilter* ts = (Arg::useAudioPid >= 0 ? new TsFilter(Arg::useAudioPid, Arg::useElementary) : NULL);
+    std::vector<char> audio;
+
+    while (pos < end)
+    {
+        ssize_t got = pread(fd, &block[0], std::min(static_cast<off_t>(kblock), end - pos), pos);
+        if (got > 0)
+        {
+            if (ts)
+            {
+                audio.clear();
+                ts->filter(&block[0], got, audio);
+                if (!audio.empty())
+                    feedOut(&audio[0], audio.size());
+            }
+            else
+                feedOut(&block[0], got);
+            pos += got;
+            cache.advance(pos);
+            idle = 0;
+        }
+        else if (got < 0 && EINTR != errno)
+            error("Could not read file to feed");
+        else if (0 == got)
+        {
+            // wait for the recording to grow
+            if (!Arg::useFollow)
+                break;
+            if (idle >= Arg::useIdleTimeout)
+            {
+                if (Arg::idleWait != Arg::useIdleAction)
+                    break;
+                fprintf(messages, "%sNo input for %.1f secs, waiting\n", prefixdebug, idle / 1000.0);
+                idle = 0;
+            }
+            usleep(kpoll * 1000);
+            idle += kpoll;
+        }
+    }
+    cache.drop(pos);
+    fprintf(messages, "%sFed %lld bytes, dropped %llu bytes from cache\n",
+            prefixinfo, static_cast<long long>(pos - Arg::useFeedFrom), cache.dropped);
+    if (ts)
+        fprintf(messages, "%sKept %llu bytes of audio, %u discontinuities\n", prefixinfo, ts->kept, ts->discontinuities);
+    delete ts;
+    close(fd);
+    return 0;
+}
+
+size_t readWindow(SNDFILE* input, int* samples, frameNumber_t window, const SF_INFO& metadata)
+// Read an analysis window of audio. Returns the samples read, 0 at the end of the input
+{
+    const size_t count = metadata.channels * Arg::windowSamples(window, metadata.samplerate);
+    return count == static_cast<size_t>(sf_read_int(input, samples, count)) ? count : 0;
+}
+
+class SparseScan
+// Scans a file by probing a frame every stride, which must fall in any silence as long as the stride,
+// and analysing every frame around the quiet ones until loud frames bound them.
+// Frames that aren't analysed are taken to be loud
+{
+public:
+    SparseScan(SNDFILE* _input, const SF_INFO& metadata, Analysis& _analysis)
+        : input(_input), analysis(_analysis), channels(metadata.channels), rate(metadata.samplerate),
+          total(metadata.frames * Arg::useWindowDen / (1LL * rate * Arg::useWindowNum)),
+          samples(channels * Arg::maxWindowSamples(rate)), levels(total + 1, kunknown), touched(0) {}
+
+    void run(Detector& detector)
+    {
+        // exports need every frame below the floor
+        const unsigned long long quiet = std::max<unsigned long long>(Arg::useExitThreshold, detector.exportFloor);
+        for (frameNumber_t probe = Arg::useSparse; probe <= total; probe += Arg::useSparse)
+        {
+            if (level(probe) >= quiet)
+                continue;
+            // extend to the loud frames either side, or frames already analysed
+            for (frameNumber_t f = probe - 1; f >= 1 && kunknown == levels[f] && level(f) < quiet; f--)
+                ;
+            for (frameNumber_t f = probe + 1; f <= total && kunknown == levels[f] && level(f) < quiet; f++)
+                ;
+        }
+
+        for (frameNumber_t f = 1; f <= total; f++)
+            detector.frame(levels[f]);
+
+        printf("%sSparse scan analysed %d of %d frames (%.1f%%)\n", prefixinfo, touched, total,
+               total ? 100.0 * touched / total : 0);
+    }
+
+private:
+    static const unsigned long long kunknown = ULLONG_MAX; // level of a frame not analysed
+
+    SNDFILE* input;
+    Analysis& analysis;
+    const int channels;
+    const int rate;             // sample frames per second
+    const frameNumber_t total;
+    std::vector<int> samples;
+    std::vector<unsigned long long> levels;
+    frameCount_t touched;       // frames analysed
+
+    unsigned long long level(frameNumber_t frame)
+    // Level of a frame, analysing it if necessary
+    {
+        if (kunknown == levels[frame])
+        {
+            const size_t count = channels * Arg::windowSamples(frame, rate);
+            if (sf_seek(input, Arg::windowStart(frame - 1, rate), SEEK_SET) < 0
+                    || count != static_cast<size_t>(sf_read_int(input, &samples[0], count)))
+                error("Could not read file for sparse scan");
+            levels[frame] = analysis.level(&samples[0], count);
+            touched++;
+        }
+        return levels[frame];
+    }
+};
+const unsigned long long SparseScan::kunknown;
+
+void control(Detector& detector)
+// Apply presets from the control file & reply with the detection state
+{
+    char value[7][32] = {"", "", "", "", "", "", ""};
+    char* values[6] = {value[0], value[1], value[2], value[3], value[4], value[5]};
+    float arg[6];
+    FILE* file = fopen(Arg::useControl, "r");
+    const int count = (file ? fscanf(file, "%31s %31s %31s %31s %31s %31s %31s",
+                                     value[0], value[1], value[2], value[3], value[4], value[5], value[6]) : 0);
+    if (file)
+        fclose(file);
+
+    const char* result = "Presets changed";
+    if (count < 6 || NULL != Arg::presets(values, arg) || (7 == count && 0 != strcmp(value[6], "recluster")))
+    {
+        result = "Control file must hold six presets, optionally followed by recluster";
+        error(result, false);
+    }
+    else
+    {
+        printf("%sPresets changed at frame %d: Threshold=%.1f, MinQuiet=%.2f, MinDetect=%.1f, MinLength=%.1f,"
+               " MaxSep=%.1f, Pad=%.2f\n", prefixinfo, detector.frames, arg[0], arg[1], arg[2], arg[3], arg[4], arg[5]);
+        if (7 == count)
+            detector.recluster();
+    }
+
+    char name[PATH_MAX];
+    snprintf(name, sizeof name, "%s.reply", Arg::useControl);
+    FILE* reply = fopen(name, "w");
+    if (NULL == reply)
+    {
+        error("Could not write control reply", false);
+        return;
+    }
+    fprintf(reply, "%s\n", result);
+    detector.state(reply);
+    fclose(reply);
+}
+
+int recluster()
+// Detect from an exported list or levels instead of audio
+{
+    Output console;
+    Detector detector(console);
+    if (!detector.relevel(Arg::useRecluster))
+        detector.replay(Arg::useRecluster);
+    detector.finish();
+    return 0;
+}
+
+frameNumber_t detect(int fd, Output& output)
+{
+    Input audio(fd);
+    SF_INFO metadata;
+    SNDFILE* input = sf_open_virtual(&Input::vio, SFM_READ, &metadata, &audio);
+    if (NULL == input)
+    {
+        output.write(prefixerr, sf_strerror(NULL));
+        return 0;
+    }
+    audio.release();
+
+    std::vector<int> samples(metadata.channels * Arg::maxWindowSamples(metadata.samplerate));
+    Analysis analysis(metadata.channels);
+    Detector detector(output);
+    size_t count;
+    while (0 != (count = readWindow(input, &samples[0], detector.frames + 1, metadata)))
+        detector.frame(analysis.level(&samples[0], count));
+    sf_close(input);
+
+    detector.finish();
+    return detector.frames;
+}
+
+class StreamOutput : public Output
+// Prefixes reports with the stream they are from
+{
+public:
+    StreamOutput(unsigned _stream) : stream(_stream) {}
+
+    void write(const char* prefix, const char* text)
+    {
+        printf("%s%u %s\n", prefix, stream, text);
+    }
+
+private:
+    const unsigned stream;
+};
+
+class ThresholdOutput : public Output
+// Prefixes reports with the further threshold they are at, ahead of their own prefix
+{
+public:
+    ThresholdOutput(unsigned _number) : number(_number) {}
+
+    void write(const char* prefix, const char* text)
+    {
+        printf("%s%u %s%s\n", prefixthreshold, number, prefix, text);
+    }
+
+private:
+    const unsigned number;
+};
+
+class Thresholds
+// Detects at the further thresholds from the levels of the main detection, so that
+// comparing them needs no more passes. Reports are prefixed by the number of the threshold
+{
+public:
+    Thresholds()
+    {
+        for (size_t i = 0; i < Arg::useThresholds.size(); i++)
+        {
+            outputs.push_back(new ThresholdOutput(i + 2));
+            detectors.push_back(new Detector(*outputs.back(), Arg::useThresholds[i]));
+        }
+    }
+
+    ~Thresholds()
+    {
+        for (size_t i = 0; i < detectors.size(); i++)
+        {
+            delete detectors[i];
+            delete outputs[i];
+        }
+    }
+
+    void frame(unsigned long long level)
+    {
+        for (size_t i = 0; i < detectors.size(); i++)
+            detectors[i]->frame(level);
+    }
+
+    void finish()
+    {
+        for (size_t i = 0; i < detectors.size(); i++)
+            detectors[i]->finish();
+    }
+
+private:
+    std::vector<ThresholdOutput*> outputs;
+    std::vector<Detector*> detectors;
+};
+
+struct Stream
+// One of several inputs detected together. Leaders keep the levels they use, whether analysed
+// or taken from their own leader, so followers can be chained
+{
+    const unsigned id;
+    int fd;
+    Input* audio;
+    SNDFILE* input;
+    int channels;
+    int rate;                   // sample frames per second
+    int width;                  // bytes per sample, 0 if unknown
+    size_t count;               // samples in the window just read
+    std::vector<int> samples;
+    Analysis* analysis;
+    StreamOutput output;
+    Detector detector;
+    Fingerprint fingerprint;
+    Stream* leader;             // stream whose levels are used instead of analysing this one's
+    frameCount_t lead;          // frames this stream started before its leader
+    frameCount_t shared;        // frames whose levels came from the leader
+    unsigned followers;         // streams using this one's levels
+    std::vector<unsigned long long> recent; // levels of the latest frames, for followers
+
+    Stream(unsigned _id, int _fd) : id(_id), fd(_fd), audio(new Input(_fd)), input(NULL),
+        channels(0), rate(0), width(0), count(0), analysis(NULL), output(_id), detector(output),
+        leader(NULL), lead(0), shared(0), followers(0) {}
+
+    void close()
+    {
+        sf_close(input);
+        delete audio;
+        delete analysis;
+        ::close(fd);
+        input = NULL;
+        audio = NULL;
+        analysis = NULL;
+    }
+
+    static int sampleWidth(int format)
+    // Bytes per sample of the input format, 0 if unknown
+    {
+        switch (format & SF_FORMAT_SUBMASK)
+        {
+        case SF_FORMAT_PCM_S8: case SF_FORMAT_PCM_U8: case SF_FORMAT_ULAW: case SF_FORMAT_ALAW:
+            return 1;
+        case SF_FORMAT_PCM_16:
+            return 2;
+        case SF_FORMAT_PCM_24:
+            return 3;
+        case SF_FORMAT_PCM_32: case SF_FORMAT_FLOAT:
+            return 4;
+        case SF_FORMAT_DOUBLE:
+            return 8;
+        default:
+            return 0;
+        }
+    }
+
+    unsigned long long level()
+    // Level of the frame just read, from the leader if it has reached it & still holds it
+    {
+        const frameNumber_t frame = detector.frames + 1;
+        if (leader && frame > lead && frame - lead <= leader->detector.frames
+                && leader->detector.frames - (frame - lead) < leader->recent.size())
+        {
+            shared++;
+            return leader->recent[(frame - lead) % leader->recent.size()];
+        }
+        return analysis->level(&samples[0], count);
+    }
+};
+
+struct Search
+// Looks for a later stream starting <offset> frames into an earlier one
+{
+    Stream* earlier;
+    Stream* later;
+    size_t probe;  // frame of later stream that starts the comparison
+    size_t offset; // next offset to try
+
+    bool step()
+    // Tries the offsets that the frames read so far allow. Returns true on a match
+    {
+        const Fingerprint& e = earlier->fingerprint;
+        const Fingerprint& l = later->fingerprint;
+        const frameCount_t length = Fingerprint::probeLength();
+        while (probe + length <= l.levels.size() && !l.distinctive(probe))
+        {
+            // the audio is too uniform to identify: try later on
+            probe += length;
+            offset = 0;
+        }
+        for (; probe + length <= l.levels.size()
+                && probe + offset + length <= e.levels.size(); offset++)
+            if (e.matches(l, probe, offset))
+                return true;
+        return false;
+    }
+
+    bool exhausted() const
+    // Whether the streams can no longer be found to match.
+    // The earlier stream will follow the later one, so mustn't follow already or lead it
+    {
+        const frameCount_t length = Fingerprint::probeLength();
+        for (const Stream* s = later; s; s = s->leader)
+            if (s == earlier)
+                return true;
+        return earlier->leader || !earlier->input || !later->input
+                || offset > Fingerprint::maxOffset()
+                || (earlier->fingerprint.full() && probe + offset + length > earlier->fingerprint.levels.size())
+                || (later->fingerprint.full() && probe + length > later->fingerprint.levels.size());
+    }
+};
+
+int streams()
+// Detect several inputs at once. A stream carrying the same audio as one that started later
+// takes its levels from that one, until it ends
+{
+    std::vector<Stream*> streams;
+    std::vector<Search> searches;
+    for (int i = 0; i < Arg::useStreamCount; i++)
+    {
+        int fd = open(Arg::useStreamFiles[i], O_RDONLY);
+        if (fd < 0)
+            error("Could not open stream");
+        Stream* s = new Stream(i + 1, fd);
+        SF_INFO metadata;
+        if (NULL == (s->input = sf_open_virtual(&Input::vio, SFM_READ, &metadata, s->audio)))
+        {
+            error(sf_strerror(NULL), false);
+            error("Could not read stream");
+        }
+        s->audio->release();
+        s->channels = metadata.channels;
+        s->rate = metadata.samplerate;
+        s->width = Stream::sampleWidth(metadata.format);
+        s->samples.resize(s->channels * Arg::maxWindowSamples(s->rate));
+        s->analysis = new Analysis(metadata.channels);
+        for (std::vector<Stream*>::iterator other = streams.begin(); other != streams.end(); ++other)
+        {
+            Search forward = {*other, s, 0, 0};
+            Search backward = {s, *other, 0, 0};
+            searches.push_back(forward);
+            searches.push_back(backward);
+        }
+        streams.push_back(s);
+    }
+
+    // read a window of each stream that has one, so that a stalled pipe doesn't hold up the others
+    unsigned reading = streams.size();
+    bool idle = false; // every stream has been stalled for the idle period
+    while (reading)
+    {
+        std::vector<pollfd> stalled;
+        for (std::vector<Stream*>::iterator it = streams.begin(); it != streams.end(); ++it)
+        {
+            Stream* s = *it;
+            if (!s->input)
+                continue;
+            s->count = s->channels * Arg::windowSamples(s->detector.frames + 1, s->rate);
+            if (!idle && !s->audio->ready(s->count * s->width))
+            {
+                pollfd waitfd = {s->fd, POLLIN, 0};
+                stalled.push_back(waitfd);
+                continue;
+            }
+            if (s->count != static_cast<size_t>(sf_read_int(s->input, &s->samples[0], s->count)))
+            {
+                s->close();
+                s->detector.finish();
+                reading--;
+                continue;
+            }
+            const unsigned long long level = s->level();
+            s->detector.frame(level);
+            if (!searches.empty())
+                s->fingerprint.add(level);
+            if (s->followers)
+                s->recent[s->detector.frames % s->recent.size()] = level;
+        }
+        // wait for any stream that is stalled if none could be read. Once the idle period passes
+        // they are read regardless, taking the idle action
+        idle = (!stalled.empty() && stalled.size() == reading
+                && 0 == poll(&stalled[0], stalled.size(), Arg::useIdleTimeout));
+
+        for (std::vector<Search>::iterator search = searches.begin(); search != searches.end();)
+        {
+            if (!search->exhausted() && search->step())
+            {
+                Stream* follower = search->earlier;
+                Stream* leader = search->later;
+                printf("%sStream %u carries the same audio as stream %u, which started %lu frames later. Sharing its levels\n",
+                       prefixinfo, follower->id, leader->id, (unsigned long)Arg::toFrames(search->offset));
+                follower->leader = leader;
+                follower->lead = search->offset;
+                if (0 == leader->followers++)
+                {
+                    // levels a follower may still need
+                    leader->recent.resize(Fingerprint::maxOffset() + 2);
+                    const std::vector<unsigned long long>& levels = leader->fingerprint.levels;
+                    for (frameNumber_t f = 1; f <= levels.size(); f++)
+                        leader->recent[f % leader->recent.size()] = levels[f - 1];
+                }
+            }
+            if (search->exhausted())
+                search = searches.erase(search);
+            else
+                ++search;
+        }
+        // fingerprints are only needed whilst searching
+        if (searches.empty())
+            for (std::vector<Stream*>::iterator it = streams.begin(); it != streams.end(); ++it)
+                (*it)->fingerprint.clear();
+    }
+
+    for (std::vector<Stream*>::iterator it = streams.begin(); it != streams.end(); ++it)
+        printf("%sStream %u: %d frames, %d analysed by stream %u\n", prefixdebug, (*it)->id,
+               (*it)->detector.frames, (*it)->shared, (*it)->leader ? (*it)->leader->id : (*it)->id);
+    return 0;
+}
+
+int main(int argc, char **argv)
+// Detect silences and allocate to clusters
+{
+    // flush output buffer after every line
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    Arg::parse(argc, argv);
+
+    if (Arg::useBackground)
+        Governor::background();
+
+    if (Arg::useFeed)
+        return feed();
+    if (Arg::useReadRing)
+        return readRing();
+    if (Arg::useStreams)
+        return streams();
+    if (Arg::useRecluster)
+        return recluster();
+    if (Arg::useCoordinate)
+        return coordinate(Arg::useCoordinate);
+    if (Arg::useWork)
+        return work(Arg::useWork, Arg::useSlots ? Arg::useSlots : sysconf(_SC_NPROCESSORS_ONLN), Arg::useDecoder);
+
+    /* Check the input is an audiofile. */
+    Input* audio = new Input(STDIN_FILENO);
+    SF_INFO metadata;
+    SNDFILE* input = sf_open_virtual(&Input::vio, SFM_READ, &metadata, audio);
+    if (NULL == input) {
+        error("libsndfile error:", false);
+        error(sf_strerror(NULL));
+    }
+    // header has been parsed so libsndfile no longer seeks
+    audio->release();
+
+    /* Allocate data buffer to contain audio data from one analysis window. */
+    int* samples = (int*)malloc(metadata.channels * Arg::maxWindowSamples(metadata.samplerate) * sizeof(int));
+    if (NULL == samples)
+        error("Couldn't allocate memory");
+
+    // create silence/cluster detector
+    Output* console = (Arg::useRing ? new RingOutput(Arg::useRing) : new Output());
+    FlightRecorder recorder(Arg::useRecorder);
+    RecordedOutput recorded(*console, recorder);
+    Detector detector(recorded);
+    recorder.watch(&detector);
+    if (Arg::useRecorder)
+    {
+        flightRecorder = &recorder;
+        atexit(dumpAtExit);
+    }
+
+    if (Arg::useExport && NULL == (detector.exportList = fopen(Arg::useExport, "w")))
+        error("Could not create export file");
+    else if (detector.exportList)
+    {
+        // the threshold or floor limits the thresholds the list can be replayed at
+        fprintf(detector.exportList, "# start end power%s\n", Arg::useFloor ? " levels" : "");
+        if (Arg::useFloor)
+            fprintf(detector.exportList, "# floor %u\n", Arg::useFloor);
+        else
+        {
+            fprintf(detector.exportList, "# threshold %u\n", Arg::useThreshold);
+            if (Arg::useExitThreshold != Arg::useThreshold)
+                fprintf(detector.exportList, "# exit %u\n", Arg::useExitThreshold);
+        }
+        fprintf(detector.exportList, "# window %u/%u\n", Arg::useWindowNum, Arg::useWindowDen);
+        detector.exportFloor = Arg::useFloor;
+    }
+
+    // Levels file: "SILV", format version, analysis window in secs as a fraction, then a level per frame.
+    // Native byte order, like snapshots
+    if (Arg::useLevels)
+    {
+        const unsigned header[3] = {1, Arg::useWindowNum, Arg::useWindowDen};
+        if (NULL == (detector.levelList = fopen(Arg::useLevels, "wb"))
+                || 1 != fwrite("SILV", 4, 1, detector.levelList)
+                || 1 != fwrite(header, sizeof header, 1, detector.levelList))
+            error("Could not create levels file");
+    }
+
+    // Resume from where an earlier scan or process finished
+    if (Arg::useReplay)
+        detector.replay(Arg::useReplay);
+    else if (Arg::useRestore)
+        detector.restore(Arg::useRestore);
+
+    Analysis analysis(metadata.channels);
+    Governor governor;
+    Thresholds thresholds;
+    LevelFeed* levelFeed = (Arg::useLevelRing ? new LevelFeed(Arg::useLevelRing, metadata.channels) : NULL);
+    size_t count;
+
+    // Snapshot & change presets on request
+    if (Arg::useSnapshot)
+        signal(SIGUSR1, requestSnapshot);
+    if (Arg::useControl)
+        signal(SIGHUP, requestControl);
+    if (Arg::useRecorder)
+        signal(SIGUSR2, requestDump);
+
+    if (Arg::useSparse && !metadata.seekable)
+        printf("%sInput isn't a file, scanning every frame\n", prefixinfo);
+    if (Arg::useSparse && metadata.seekable)
+    {
+        audio->scatter();
+        SparseScan(input, metadata, analysis).run(detector);
+    }
+    // Process the input one frame at a time and process cuts along the way.
+    else while (0 != (count = readWindow(input, samples, detector.frames + 1, metadata)))
+    {
+        // keep up with a live recording
+        if (Arg::useLiveStart && 0 == (detector.frames + 1) % Analysis::period())
+            analysis.check(detector.frames + 1);
+        // keep within CPU budget
+        if (Arg::useCpuBudget && 0 == (detector.frames + 1) % Governor::batch())
+            governor.pace();
+
+        // determine average audio level in this frame & detect with it
+        const unsigned long long level = (levelFeed ? levelFeed->level(analysis, samples, count, detector.frames + 1)
+                                          : analysis.level(samples, count));
+        recorder.frame(detector.frames + 1, level);
+        detector.frame(level);
+        if (!Arg::useThresholds.empty())
+            thresholds.frame(level);
+
+        // presets apply from the next frame
+        if (controlRequested)
+        {
+            controlRequested = 0;
+            control(detector);
+        }
+
+        // for post-mortems
+        if (Arg::useRecorder && (dumpRequested || recorder.anomaly))
+        {
+            recorder.dump(dumpRequested ? "Requested" : recorder.anomaly);
+            dumpRequested = 0;
+            recorder.anomaly = NULL;
+        }
+
+        // hand over to another process
+        if (snapshotRequested)
+        {
+            detector.snapshot(Arg::useSnapshot, audio->position());
+            printf("%sSnapshot at frame %d written to %s\n", prefixinfo, detector.frames, Arg::useSnapshot);
+            exit(0);
+        }
+    }
+    sf_close(input);
+    delete audio;
+
+    detector.finish();
+    thresholds.finish();
+    if (Arg::useRecorder)
+        recorder.dump(recorder.anomaly ? recorder.anomaly : "Finished");
+    flightRecorder = NULL;
+
+    if (Arg::useCpuBudget)
+        printf("%sThrottled for %.1f secs to stay within CPU budget\n", prefixinfo, governor.throttled);
+    if (Arg::useStats)
+        printf("%sMade %llu allocations\n", prefixinfo, allocations);
+    if (detector.exportList)
     {
-        processCluster();
+        fprintf(detector.exportList, "frames %d\n", detector.frames);
+        fclose(detector.exportList);
     }
+    if (detector.levelList && 0 != fclose(detector.levelList))
+        error("Could not write levels file");
+    // readers of rings learn that detection has finished
+    delete console;
+    delete levelFeed;
 }
 
@@ -0,0 +1,97 @@
+// Interface to silence detection for the modes that distribute it
+// Public domain.
+
+#ifndef SILENCE_H
+#define SILENCE_H
+
+#include <cstdio>
+
+typedef unsigned frameNumber_t;
+typedef unsigned frameCount_t;
+
+// Output to python wrapper requires prefix to indicate level
+#define DELIMITER "@" // must correlate with python wrapper
+extern char prefixdebug[7];
+extern char prefixinfo[6];
+extern char prefixerr[5];
+extern char prefixcut[5];
+extern char prefixreset[7];
+
+extern FILE* messages; // stderr when stdout carries data
+
+void error(const char* mesg, bool die = true);
+
+// Reports as fixed-size records, for consumers that follow a ring (--ring) instead of parsing them
+enum eventKind_t {eventSilence = 1, eventCluster, eventCut, eventReset, eventEnd};
+
+struct Event
+{
+    unsigned long long sequence; // of the record from 1. 0 whilst it is being written
+    char kind;                   // eventKind_t
+    char state;                  // state log character of the silence/cluster
+    char reserved[2];
+    frameNumber_t start, end;    // video frames
+    frameCount_t interval;       // video frames since the previous silence/cluster
+    int power;                   // level of a silence, silences in a cluster
+};
+
+// Level of a frame (--level-ring), for analysers that shouldn't decode the audio again
+struct Level
+{
+    static const int kchannels = 8;
+    unsigned long long sequence; // frame number. 0 whilst it is being written
+    unsigned level;              // average absolute sample of the frame
+    unsigned channel[kchannels]; // of each channel when every sample was analysed, otherwise 0
+};
+
+// Ring file layout: this header, then <size> records. There is one writer, which never waits,
+// and any number of readers. Readers follow <written> and detect that the writer has lapped
+// them from the sequence of a record. They may wait on the futex <wakeups> after adding
+// themselves to <waiting>, so that the writer only makes a syscall when someone is waiting.
+// Native byte order: the version detects a mismatch
+struct RingHeader
+{
+    char magic[4];              // "SILR" for events, "SILL" for levels
+    unsigned version;
+    unsigned size;              // records the ring holds
+    unsigned recordSize;
+    unsigned windowNum, windowDen; // analysis window in secs, that frames are
+    unsigned channels;          // of the audio, for levels
+    unsigned reserved;
+    unsigned long long written; // records published
+    int wakeups;                // changes whenever records are published
+    int waiting;                // readers waiting on wakeups
+    int finished;               // the writer has published its last record
+    unsigned long long first;   // sequence of the first record published, 0 until one is
+};
+
+class Output
+// Destination of detection reports. Writes them to stdout unless specialised
+{
+public:
+    virtual ~Output() {}
+
+    virtual void write(const char* prefix, const char* text)
+    {
+        printf("%s%s\n", prefix, text);
+    }
+
+    virtual void event(eventKind_t /*kind*/, char /*state*/, frameNumber_t /*start*/, frameNumber_t /*end*/,
+                       frameCount_t /*interval*/, int /*power*/) {}
+};
+
+namespace Arg
+{
+// Convert the six detection presets (threshold..pad) for use by the calling thread.
+// Fills args with their values. Returns NULL or the name of an invalid preset
+const char* presets(char* const* values, float* args);
+}
+
+// Detect silences & clusters in an AU stream, reporting them to output. Returns frames read
+frameNumber_t detect(int fd, Output& output);
+
+// Distributed flagging (coordinator.cpp)
+int coordinate(const char* address);
+int work(const char* coordinator, unsigned slots, const char* decoder);
+
+#endif
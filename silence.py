@@ -8,6 +8,17 @@
 # v4.1 Use unicode for foreign chars
 # v4.2 Prevent BE writeStringList errors
 # v5.0 Improve exception handling/logging. Fix player messages (0.26+ only)
+# v5.1 Scan the existing part of a recording in parallel chunks before following it
+# v5.2 Tell silence when a live recording started so it can keep up
+# v5.3 Run backlog scans at idle priority. Optional CPU budget
+# v5.4 Read recordings with silence --feed so they don't flood the page cache
+# v5.5 Optionally flag on another host via a silence --coordinator
+# v5.6 Presets can be changed whilst flagging via /tmp/silence-<chanid>_<starttime>.control
+# v5.7 Optional video frame rate & analysis window
+# v5.8 Optionally adapt the threshold to the programme floor
+# v5.9 Optional hysteresis
+# v5.10 Cache the audio stream of each channel so that ffmpeg decodes without probing the stream
+# v5.11 Only feed the packets of the audio stream to ffmpeg
 
 import MythTV
 import os
@@ -16,9 +27,21 @@ import argparse
 import collections
 import re
 import sys
+import tempfile
+import multiprocessing
+import calendar
+import time
+import socket
+import threading
+import json
 
 kExe_Silence = '/usr/local/bin/silence'
 kUpmix_Channels = '6' # Change this to 2 if you never have surround sound in your recordings.
+kCatchup_Chunk = 64 * 1024 * 1024 # smallest part of a recording worth scanning in parallel
+kTS_Packet = 188
+kBackground = ['chrt', '--idle', '0', 'ionice', '-c', '3'] # prefix for commands run at idle priority
+kProbe_Cache = os.path.join(tempfile.gettempdir(), 'silence-probe.json') # audio stream of each channel
+kProbe_Size = '65536' # bytes ffmpeg reads to start a stream it has been told about
 
 class MYLOG(MythTV.MythLog):
   "A specialised logger"
@@ -96,6 +119,248 @@ class PRESET:
     "Returns params as a list of strings"
     return [str(i) for i in list(self.argdict.values())]
 
+class PROBE:
+  """Caches the audio stream of each channel (PID, codec, layout, rate) so that ffmpeg can decode
+     recordings of it from the first packets, instead of probing seconds of the stream each time"""
+
+  def __init__(self, callsign, infile, logger):
+    "Finds the channel's audio stream in the cache, or probes the recording for it"
+    self.callsign = callsign
+    self.logger = logger
+    self.stream = self._load().get(callsign)
+    if self.stream:
+      logger.log('Using cached audio stream %s' % self.stream, MYLOG.DEBUG)
+      return
+    self.stream = self._probe(infile)
+    if self.stream:
+      logger.log('Caching audio stream %s' % self.stream, MYLOG.DEBUG)
+      self._update(self.stream)
+
+  def _load(self):
+    try:
+      with open(kProbe_Cache) as cache:
+        return json.load(cache)
+    except (IOError, ValueError):
+      return {}
+
+  def _update(self, stream):
+    "Stores or forgets the channel's stream, replacing the cache atomically"
+    cache = self._load()
+    if stream:
+      cache[self.callsign] = stream
+    else:
+      cache.pop(self.callsign, None)
+    handle, partial = tempfile.mkstemp(dir=os.path.dirname(kProbe_Cache))
+    with os.fdopen(handle, 'w') as out:
+      json.dump(cache, out)
+    os.rename(partial, kProbe_Cache)
+
+  def _probe(self, infile):
+    "Returns the first audio stream of an MPEG-TS recording, or None"
+    try:
+      info = json.loads(subprocess.check_output(["mythffprobe", "-v", "quiet", "-print_format", "json",
+                         "-show_format", "-show_streams", "-select_streams", "a", infile]).decode('utf-8'))
+      # PIDs are only meaningful in a transport stream
+      if info.get('format', {}).get('format_name') != 'mpegts':
+        return None
+      for stream in info.get('streams', []):
+        if stream.get('id') and stream.get('codec_name'):
+          return {'pid': stream['id'], 'codec': stream['codec_name'], 'rate': stream.get('sample_rate'),
+                  'layout': stream.get('channel_layout')}
+    except (OSError, subprocess.CalledProcessError, ValueError) as e:
+      self.logger.log('Could not probe audio stream: %s' % e, MYLOG.DEBUG)
+    return None
+
+  def forget(self):
+    "Drops a stream that didn't decode, so that the next recording is probed"
+    if self.stream:
+      self.logger.log('Forgetting cached audio stream %s' % self.stream, MYLOG.INFO)
+      self.stream = None
+      self._update(None)
+
+  def feed(self):
+    "Returns silence --feed options that only pass on the stream's packets"
+    return ["--audio-pid=" + self.stream['pid']] if self.stream else []
+
+  def options(self):
+    "Returns ffmpeg options before & after its input for the stream"
+    if not self.stream:
+      return [], []
+    return (["-f", "mpegts", "-probesize", kProbe_Size, "-analyzeduration", "0", "-c:a", self.stream['codec']],
+            ["-map", "0:i:" + self.stream['pid']])
+
+
+def epoch(dt):
+  "Converts a recording time to seconds since the epoch"
+  if getattr(dt, 'tzinfo', None):  # only 0.26+
+    return calendar.timegm(dt.utctimetuple())
+  return time.mktime(dt.timetuple())
+
+def decoder(source, prefix=[], probe=None):
+  "Starts ffmpeg extracting the uncompressed audio stream from a pipe"
+  before, after = probe.options() if probe else ([], [])
+  return subprocess.Popen(prefix + ["mythffmpeg", "-loglevel", "quiet"] + before + ["-i", "pipe:0"] + after
+                + ["-f", "au", "-ac", kUpmix_Channels, "-"],
+                stdin=source, stdout=subprocess.PIPE)
+
+def catchup(infile, presets, detection, workers, live, probe, logger):
+  """Scans the existing part of a recording in parallel chunks, keeping it cached if it is live.
+     Returns a file of the silences found & the number of bytes scanned"""
+  size = os.path.getsize(infile) // kTS_Packet * kTS_Packet
+  chunks = min(workers, size // kCatchup_Chunk)
+  if chunks < 2:
+    return None, 0
+  logger.log('Catching up %d bytes in %d chunks' % (size, chunks), MYLOG.DEBUG)
+
+  # chunks must start on a TS packet
+  length = size // chunks // kTS_Packet * kTS_Packet
+  scans = []
+  devnull = open(os.devnull, 'w')
+  for i in range(chunks):
+    start = i * length
+    count = size - start if i == chunks - 1 else length
+    handle, listfile = tempfile.mkstemp(suffix='.silences')
+    os.close(handle)
+    # the backlog must never hold up the recorder
+    reader = subprocess.Popen([kExe_Silence, "--background", "--feed=" + infile,
+                "--from=%d" % start, "--length=%d" % count] + probe.feed()
+                + (["--keep-cache"] if live else []), stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    audio = decoder(reader.stdout, kBackground, probe)
+    scan = subprocess.Popen([kExe_Silence, "--background", "--export=" + listfile] + detection + ["0"] + presets,
+                stdin=audio.stdout, stdout=devnull)
+    # only the consumers hold the pipes
+    reader.stdout.close()
+    audio.stdout.close()
+    scans.append((scan, listfile, reader))
+
+  # join the chunk lists into one covering the whole backlog
+  silences = []
+  offset = 0
+  window = None
+  for scan, listfile, reader in scans:
+    if scan.wait() != 0:
+      probe.forget()
+      raise RuntimeError('Catch-up scan failed')
+    logger.log(re.sub(r'^\w+@', '', reader.communicate()[1].decode(), flags=re.M), MYLOG.DEBUG)
+    frames = 0
+    with open(listfile) as chunk:
+      for line in chunk:
+        vals = line.split()
+        if vals[:2] == ['#', 'window']:
+          window = line
+        if not vals or vals[0].startswith('#'):
+          continue
+        if vals[0] == 'frames':
+          frames = int(vals[1])
+          continue
+        start, end, power = int(vals[0]) + offset, int(vals[1]) + offset, float(vals[2])
+        if silences and silences[-1][1] + 1 == start:
+          # silence spans the chunk boundary
+          prev = silences[-1]
+          prevLength, length = prev[1] - prev[0] + 1, end - start + 1
+          prev[2] = (prev[2] * prevLength + power * length) / (prevLength + length)
+          prev[1] = end
+        else:
+          silences.append([start, end, power])
+    os.remove(listfile)
+    offset += frames
+  devnull.close()
+
+  handle, listfile = tempfile.mkstemp(suffix='.silences')
+  with os.fdopen(handle, 'w') as joined:
+    joined.write('# start end power\n')
+    if window:
+      joined.write(window)
+    for start, end, power in silences:
+      joined.write('%d %d %.1f\n' % (start, end, power))
+    joined.write('frames %d\n' % offset)
+  logger.log('Caught up %d frames' % offset, MYLOG.DEBUG)
+  return listfile, size
+
+def local(infile, presets, args, rec, control, probe, logger):
+  """Starts the pipeline that flags a recording on this host.
+     Returns its report lines, the feeder & any catch-up list to remove afterwards"""
+  # Scan what has already been recorded at full speed
+  # frames are counted in analysis windows & silences end at the hysteresis, so every scan must use the same
+  detection = ((["--fps=" + args.fps] if args.fps else []) + (["--window=" + args.window] if args.window else [])
+               + (["--hysteresis=" + args.hysteresis] if args.hysteresis else []))
+  # Someone may be watching a live recording so only drop it from the cache once it has finished
+  live = epoch(rec.endtime) > time.time()
+  # an adaptive threshold depends on every level before it, so can't be scanned in chunks
+  if args.adaptive:
+    replay, scanned = None, 0
+  else:
+    replay, scanned = catchup(infile, presets, detection, args.workers, live, probe, logger)
+
+  # Pipe file through ffmpeg to extract uncompressed audio stream. Keep going till recording is finished.
+  prefix = kBackground if args.background else []
+  p1 = subprocess.Popen([kExe_Silence, "--feed=" + infile, "--from=%d" % scanned, "--follow"] + probe.feed()
+              + (["--keep-cache"] if live else []) + (["--background"] if args.background else []),
+              stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+  p2 = decoder(p1.stdout, prefix, probe)
+  # Pipe audio stream to C++ silence which will spit out formatted log lines.
+  # It resumes from the end of any catch-up scan
+  options = detection + (["--replay=" + replay] if replay else [])
+  if live:
+    options.append("--live-start=%d" % epoch(rec.starttime))
+  if args.background:
+    options.append("--background")
+  if args.cpu_budget:
+    options.append("--cpu-budget=" + args.cpu_budget)
+  if args.adaptive:
+    options.append("--adaptive=" + args.adaptive)
+  # write new presets to the control file & send SIGHUP to change them
+  options.append("--control=" + control)
+  logger.log('Presets can be changed via %s' % control, MYLOG.DEBUG)
+  p3 = subprocess.Popen([kExe_Silence] + options + ["%d" % p1.pid] + presets, stdin=p2.stdout,
+              stdout=subprocess.PIPE)
+  # only the consumers hold the pipes
+  p1.stdout.close()
+  p2.stdout.close()
+  return iter(p3.stdout.readline, b''), p1, replay
+
+def remote(coordinator, infile, presets, stream, probe, logger):
+  """Runs the job on a worker chosen by a silence coordinator.
+     Yields report lines as if from a local silence"""
+  host, port = coordinator.rsplit(':', 1)
+  conn = socket.create_connection((host, int(port)))
+  replies = conn.makefile('rb')
+  # workers read the file from a shared mount unless it is streamed to them
+  conn.sendall(('job@%s %s %s\n' % (socket.gethostname(), ' '.join(presets),
+                '-' if stream else infile)).encode('utf-8'))
+
+  def send(jobid):
+    "Streams decoded audio to the worker"
+    feed = subprocess.Popen([kExe_Silence, "--feed=" + infile, "--follow"] + probe.feed(), stdout=subprocess.PIPE)
+    audio = decoder(feed.stdout, [], probe)
+    feed.stdout.close()
+    while True:
+      block = audio.stdout.read(65536)
+      if not block:
+        break
+      conn.sendall(('data@%s %d\n' % (jobid, len(block))).encode() + block)
+    conn.sendall(('end@%s\n' % jobid).encode())
+    audio.wait()
+    feed.wait()
+
+  for line in replies:
+    flag, info = line.decode('utf-8').split('@', 1)
+    jobid, info = (info.split(' ', 1) + [''])[:2]
+    if flag == 'queued':
+      logger.log('Queued as job %s on %s' % (jobid.strip(), coordinator), MYLOG.DEBUG)
+    elif flag == 'started':
+      logger.log('Started on %s' % info.strip(), MYLOG.INFO)
+      if stream:
+        sender = threading.Thread(target=send, args=(jobid.strip(),))
+        sender.daemon = True
+        sender.start()
+    elif flag == 'done':
+      if info.strip() == 'failed':
+        raise RuntimeError('Remote job failed')
+      break
+    else:
+      yield flag + '@' + info
+  conn.close()
 
 def main():
   "Commflag a recording"
@@ -107,6 +372,18 @@ def main():
     parser.add_argument('--chanid', type=int, help='Use chanid for manual operation')
     parser.add_argument('--starttime', help='Use starttime for manual operation')
     parser.add_argument('--dump', action="store_true", help='Generate stack trace of exception')
+    parser.add_argument('--workers', type=int, default=multiprocessing.cpu_count(),
+                        help='Number of parallel scans of an existing recording (1 disables)')
+    parser.add_argument('--background', action="store_true",
+                        help='Run at idle CPU & I/O priority, ie. when re-flagging old recordings')
+    parser.add_argument('--cpu-budget', help='Maximum share of a CPU for silence detection, ie. 0.25')
+    parser.add_argument('--fps', help='Video frame rate of recordings as a rate or fraction, ie. 30000/1001')
+    parser.add_argument('--window', help='Milliseconds of audio analysed at once, default a video frame')
+    parser.add_argument('--hysteresis', help='dB above the threshold that ends a silence, ie. 3')
+    parser.add_argument('--adaptive', help='Raise the threshold to this many dB below the programme floor, ie. 20')
+    parser.add_argument('--coordinator', help='Flag on a worker of the silence coordinator at host:port')
+    parser.add_argument('--stream', action="store_true",
+                        help='Stream audio to the worker instead of it reading the recording from a shared mount')
     parser.add_argument('jobid', nargs='?', help='Myth job id')
 
     # must set up log attributes before Db locks them
@@ -115,6 +392,14 @@ def main():
 
     # parse options
     args = parser.parse_args()
+    # a worker runs every job in one process, so detection options are those it was started with
+    if args.coordinator:
+      local_only = [o for o, v in (('--fps', args.fps), ('--window', args.window), ('--hysteresis', args.hysteresis),
+                                   ('--adaptive', args.adaptive), ('--background', args.background),
+                                   ('--cpu-budget', args.cpu_budget)) if v]
+      if local_only:
+        parser.error("%s can't be used with --coordinator: a worker runs every job with the options it was started with"
+                     % ', '.join(local_only))
 
     # connect to backend
     db = MythTV.MythDB()
@@ -172,15 +457,15 @@ def main():
     elif args.presetfile:  # use preset file
       param.getFromFile(args.presetfile, rec.title, channel.callsign)
 
-    # Pipe file through ffmpeg to extract uncompressed audio stream. Keep going till recording is finished.
     infile = os.path.join(sg.dirname, rec.basename)
-    p1 = subprocess.Popen(["tail", "--follow", "--bytes=+1", infile], stdout=subprocess.PIPE)
-    p2 = subprocess.Popen(["mythffmpeg", "-loglevel", "quiet", "-i", "pipe:0",
-                "-f", "au", "-ac", kUpmix_Channels, "-"],
-                stdin=p1.stdout, stdout=subprocess.PIPE)
-    # Pipe audio stream to C++ silence which will spit out formatted log lines
-    p3 = subprocess.Popen([kExe_Silence, "%d" % p1.pid] + param.getValues(), stdin=p2.stdout,
-                stdout=subprocess.PIPE)
+    probe = PROBE(channel.callsign, infile, logger)
+    if args.coordinator:
+      # a worker elsewhere does the whole job
+      replay, p1 = None, None
+      lines = remote(args.coordinator, infile, param.getValues(), args.stream, probe, logger)
+    else:
+      control = os.path.join(tempfile.gettempdir(), 'silence-%s.control' % progId)
+      lines, p1, replay = local(infile, param.getValues(), args, rec, control, probe, logger)
 
     # Purge any existing skip list and flag as in-progress
     rec.commflagged = 2
@@ -190,34 +475,49 @@ def main():
     # Process log output from C++ silence
     breaks = 0
     level = {'info': MYLOG.INFO, 'debug': MYLOG.DEBUG, 'err': MYLOG.ERR}
-    while True:
-      line = p3.stdout.readline()
-      if line:
-        flag, info = line.split('@', 1)
-        if flag == 'cut':
-          # extract numbers from log line
-          numbers = re.findall('\d+', info)
-          logger.log(info)
-          # mark advert in database
-          rec.markup.append(int(numbers[0]), rec.markup.MARK_COMM_START, None)
-          rec.markup.append(int(numbers[1]), rec.markup.MARK_COMM_END, None)
-          rec.update()
-          breaks += 1
-          # send new advert skiplist to MythPlayers
-          skiplist = ['%d:%d,%d:%d'%(x, rec.markup.MARK_COMM_START, y, rec.markup.MARK_COMM_END)
-                   for x, y in rec.markup.getskiplist()]
-          mesg = 'COMMFLAG_UPDATE %s %s'%(progId, ','.join(skiplist))
-#         logger.log('  Sending %s'%mesg,  MYLOG.DEBUG)
-          result = be.backendCommand("MESSAGE[]:[]" + mesg)
-          if result != 'OK':
-            logger.log('Sending update message to backend failed, response = %s, message = %s'% (result, mesg), MYLOG.ERR)
-        elif flag in level:
-          logger.log(info, level.get(flag))
-        else:  # unexpected prefix
-          # use warning for unexpected log levels
-          logger.log(flag, MYLOG.WARNING)
-      else:
-        break
+    for line in lines:
+      flag, info = line.split('@', 1)
+      if flag == 'cut':
+        # extract numbers from log line
+        numbers = re.findall('\d+', info)
+        logger.log(info)
+        # mark advert in database
+        rec.markup.append(int(numbers[0]), rec.markup.MARK_COMM_START, None)
+        rec.markup.append(int(numbers[1]), rec.markup.MARK_COMM_END, None)
+        rec.update()
+        breaks += 1
+        # send new advert skiplist to MythPlayers
+        skiplist = ['%d:%d,%d:%d'%(x, rec.markup.MARK_COMM_START, y, rec.markup.MARK_COMM_END)
+                 for x, y in rec.markup.getskiplist()]
+        mesg = 'COMMFLAG_UPDATE %s %s'%(progId, ','.join(skiplist))
+#       logger.log('  Sending %s'%mesg,  MYLOG.DEBUG)
+        result = be.backendCommand("MESSAGE[]:[]" + mesg)
+        if result != 'OK':
+          logger.log('Sending update message to backend failed, response = %s, message = %s'% (result, mesg), MYLOG.ERR)
+      elif flag == 'reset':
+        # presets have changed & all cuts will be reported again
+        logger.log(info)
+        rec.markup.clean()
+        rec.update()
+        breaks = 0
+      elif flag == 'threshold':
+        # reports at a further threshold are for comparison & never cut
+        logger.log(info, MYLOG.DEBUG)
+      elif flag in level:
+        logger.log(info, level.get(flag))
+        # no audio reached silence
+        if flag == 'err' and 'libsndfile' in info:
+          probe.forget()
+      else:  # unexpected prefix
+        # use warning for unexpected log levels
+        logger.log(flag, MYLOG.WARNING)
+
+    if replay:
+      os.remove(replay)
+    # feed reports cache use unless it was killed when idle
+    report = p1.communicate()[1].decode() if p1 else ''
+    if report:
+      logger.log(re.sub(r'^\w+@', '', report, flags=re.M), MYLOG.DEBUG)
 
     # Signal comflagging has finished
     rec.commflagged = 1
@@ -230,7 +530,6 @@ def main():
 
     # Finishing too quickly can cause writeStringList/socket errors in the BE. (pre-0.28 only?)
     # A short delay prevents this
-    import time
     time.sleep(1)
 
   except Exception as e: